@@ -1,9 +1,38 @@
 #include "devices/block.h"
+#include <blkstat.h>
 #include <list.h>
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Request queueing.
+
+   Requests to a device whose driver asks for an elevator go into
+   a queue, kept in sector order and in arrival order, and the
+   device's I/O thread carries them out one batch at a time, so
+   that the submitter does not hold up the disk or the disk the
+   submitter.  Batches are chosen as by a one-way elevator
+   (C-SCAN), which sweeps across the disk from low sectors to
+   high and then starts over, except that a request that has
+   waited past its deadline goes first, as in Linux's deadline
+   scheduler.  Reads, which someone is usually waiting for, get
+   the shorter deadline.  Requests that continue where a batch
+   ends are merged into it. */
+
+/* Ticks a request may wait before it is served out of turn. */
+#define READ_EXPIRE (TIMER_FREQ / 2)
+#define WRITE_EXPIRE (TIMER_FREQ * 5)
+
+/* Limits on a batch of merged requests. */
+#define BATCH_REQS 16           /* Requests. */
+#define BATCH_IOV 32            /* Buffers. */
+#define BATCH_SECTORS 256       /* Sectors. */
 
 /* A block device. */
 struct block
@@ -17,8 +46,25 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
+    /* Request queue, if the driver wants an elevator. */
+    struct lock queue_lock;             /* Protects the members below. */
+    struct condition queue_nonempty;    /* Signaled when queued to. */
+    struct list sorted;                 /* Queued requests by sector. */
+    struct list fifo;                   /* Queued requests by arrival. */
+    block_sector_t head;                /* Sector after the last batch. */
+
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long seek_total;      /* Sum of seek distances. */
+    block_sector_t next_sector;         /* Sector after the last access. */
+
+    /* Statistics, protected by queue_lock. */
+    struct blkstat stats[BLKSTAT_CLASS_CNT];  /* By class of user. */
+    unsigned depth;                     /* Requests queued or in flight. */
+    unsigned depth_peak;                /* Highest DEPTH. */
+    uint64_t depth_cycles;              /* Integral of DEPTH over time. */
+    uint64_t depth_since;               /* Cycle count of last change. */
+    uint64_t start_cycles;              /* Cycle count at registration. */
   };
 
 /* List of all block devices. */
@@ -28,6 +74,24 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static void transfer (struct block *, block_sector_t,
+                      const struct block_iovec *, size_t iov_cnt,
+                      bool write);
+static int role_class (const struct block *);
+static void finish (struct block *, struct block_request *);
+static void complete (struct block_request *);
+static list_less_func request_less;
+static void queue_thread (void *block_);
+static size_t next_batch (struct block *, struct block_request **);
+static block_sector_t dispatch (struct block *, block_sector_t,
+                                const struct block_iovec *, size_t iov_cnt,
+                                bool write, size_t cnt);
+static block_sector_t note_access (struct block *, block_sector_t,
+                                   size_t cnt);
+static void change_depth (struct block *, int);
+static void account (struct block *, const struct block_request *);
+static void print_histogram (const char *, const unsigned *);
+static bool lock_for_stats (struct block *);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +184,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +195,496 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Reads CNT sectors starting at SECTOR from BLOCK into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes, in as
+   few device requests as the driver allows. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     size_t cnt, void *buffer)
+{
+  struct block_iovec iov;
+
+  iov.buffer = buffer;
+  iov.cnt = cnt;
+  block_readv (block, sector, &iov, 1);
+}
+
+/* Writes CNT sectors starting at SECTOR to BLOCK from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes, in as few
+   device requests as the driver allows.  Returns after the block
+   device has acknowledged receiving the data. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer)
+{
+  struct block_iovec iov;
+
+  iov.buffer = (void *) buffer;
+  iov.cnt = cnt;
+  block_writev (block, sector, &iov, 1);
+}
+
+/* Reads consecutive sectors starting at SECTOR from BLOCK into
+   the IOV_CNT buffers in IOV, in order. */
+void
+block_readv (struct block *block, block_sector_t sector,
+             const struct block_iovec *iov, size_t iov_cnt)
+{
+  transfer (block, sector, iov, iov_cnt, false);
+}
+
+/* Writes the IOV_CNT buffers in IOV, in order, to consecutive
+   sectors of BLOCK starting at SECTOR.  Returns after the block
+   device has acknowledged receiving the data. */
+void
+block_writev (struct block *block, block_sector_t sector,
+              const struct block_iovec *iov, size_t iov_cnt)
+{
+  transfer (block, sector, iov, iov_cnt, true);
+}
+
+/* Transfers consecutive sectors starting at SECTOR between BLOCK
+   and the IOV_CNT buffers in IOV, to BLOCK if WRITE, and waits
+   for the transfer to finish.
+
+   Buffers in user memory go through a bounce buffer instead, a
+   page at a time.  The transfer may be carried out by the
+   device's I/O thread, which cannot see the submitter's user
+   memory, and a driver must not fault on a page that is not
+   present, since bringing it in could need the same device. */
+static void
+transfer (struct block *block, block_sector_t sector,
+          const struct block_iovec *iov, size_t iov_cnt, bool write)
+{
+  struct block_request r;
+  struct block_iovec piece;
+  size_t bounce_cnt;
+  void *bounce;
+  size_t i, j;
+
+  for (i = 0; i < iov_cnt; i++)
+    if (!is_kernel_vaddr (iov[i].buffer))
+      break;
+  if (i == iov_cnt)
+    {
+      block_request_init (&r, sector, iov, iov_cnt, write);
+      block_submit (block, &r);
+      block_wait (&r);
+      return;
+    }
+
+  bounce_cnt = PGSIZE / BLOCK_SECTOR_SIZE;
+  bounce = palloc_get_page (0);
+  if (bounce == NULL)
+    {
+      bounce_cnt = 1;
+      bounce = malloc (BLOCK_SECTOR_SIZE);
+      if (bounce == NULL)
+        PANIC ("out of memory for block bounce buffer");
+    }
+
+  piece.buffer = bounce;
+  for (i = 0; i < iov_cnt; i++)
+    for (j = 0; j < iov[i].cnt; j += piece.cnt)
+      {
+        uint8_t *buffer = (uint8_t *) iov[i].buffer + j * BLOCK_SECTOR_SIZE;
+
+        piece.cnt = iov[i].cnt - j < bounce_cnt ? iov[i].cnt - j : bounce_cnt;
+        if (write)
+          memcpy (bounce, buffer, piece.cnt * BLOCK_SECTOR_SIZE);
+        block_request_init (&r, sector, &piece, 1, write);
+        block_submit (block, &r);
+        block_wait (&r);
+        if (!write)
+          memcpy (buffer, bounce, piece.cnt * BLOCK_SECTOR_SIZE);
+        sector += piece.cnt;
+      }
+
+  if (bounce_cnt > 1)
+    palloc_free_page (bounce);
+  else
+    free (bounce);
+}
+
+/* Initializes R as a request to transfer the consecutive sectors
+   starting at SECTOR between the device and the IOV_CNT buffers
+   in IOV, which must stay put until R completes: to the device if
+   WRITE, from it otherwise.  R completes by being up'd for
+   block_wait(), unless the caller sets R's CALLBACK. */
+void
+block_request_init (struct block_request *r, block_sector_t sector,
+                    const struct block_iovec *iov, size_t iov_cnt,
+                    bool write)
+{
+  size_t i;
+
+  r->sector = sector;
+  r->iov = iov;
+  r->iov_cnt = iov_cnt;
+  r->cnt = 0;
+  for (i = 0; i < iov_cnt; i++)
+    r->cnt += iov[i].cnt;
+  r->write = write;
+  r->callback = NULL;
+  r->aux = NULL;
+  sema_init (&r->done, 0);
+}
+
+/* Queues request R to BLOCK and returns, usually before R is
+   done.  Requests to a device with an elevator are carried out
+   by its I/O thread in the order described at the top of this
+   file; requests to other devices are carried out at once.
+   R's buffers must be in kernel memory. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  size_t i;
+
+  for (i = 0; i < r->iov_cnt; i++)
+    ASSERT (is_kernel_vaddr (r->iov[i].buffer));
+  if (r->cnt > 0)
+    {
+      check_sector (block, r->sector);
+      check_sector (block, r->sector + r->cnt - 1);
+    }
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+
+  /* The request counts toward the role of the device it was
+     submitted to, whose block types match the first classes, but
+     is carried out by the device under any stacking. */
+  r->class = role_class (block);
+  while (block->ops->remap != NULL)
+    block = block->ops->remap (block->aux, &r->sector);
+  r->start_cycles = timer_cycles ();
+  r->start_ticks = timer_ticks ();
+
+  if (r->cnt == 0)
+    {
+      complete (r);
+      return;
+    }
+
+  lock_acquire (&block->queue_lock);
+  r->depth = block->depth;
+  change_depth (block, 1);
+  if (!block->ops->elevator)
+    {
+      lock_release (&block->queue_lock);
+      r->seek = dispatch (block, r->sector, r->iov, r->iov_cnt, r->write,
+                          r->cnt);
+      finish (block, r);
+      return;
+    }
+
+  r->deadline = timer_ticks () + (r->write ? WRITE_EXPIRE : READ_EXPIRE);
+  list_insert_ordered (&block->sorted, &r->sort_elem, request_less, NULL);
+  list_push_back (&block->fifo, &r->fifo_elem);
+  cond_signal (&block->queue_nonempty, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/* Waits for request R, which must have no callback, to
+   complete. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->callback == NULL);
+  sema_down (&r->done);
+}
+
+/* Returns the blkstat class for requests to BLOCK: its type, if
+   that is a role, otherwise the role it was cast in, as a raw RAM
+   disk may be for swap. */
+static int
+role_class (const struct block *block)
+{
+  enum block_type role;
+
+  if (block->type < BLOCK_ROLE_CNT)
+    return block->type;
+  for (role = 0; role < BLOCK_ROLE_CNT; role++)
+    if (block_by_role[role] == block)
+      return role;
+  return BLKSTAT_OTHER;
+}
+
+/* Accounts for R, which BLOCK has carried out, and tells R's
+   submitter that R is done. */
+static void
+finish (struct block *block, struct block_request *r)
+{
+  lock_acquire (&block->queue_lock);
+  account (block, r);
+  change_depth (block, -1);
+  lock_release (&block->queue_lock);
+  complete (r);
+}
+
+/* Tells R's submitter that R is done. */
+static void
+complete (struct block_request *r)
+{
+  /* The callback may free R, so it is all we do. */
+  if (r->callback != NULL)
+    r->callback (r);
+  else
+    sema_up (&r->done);
+}
+
+/* Returns true if request A starts before request B. */
+static bool
+request_less (const struct list_elem *a, const struct list_elem *b,
+              void *aux UNUSED)
+{
+  return (list_entry (a, struct block_request, sort_elem)->sector
+          < list_entry (b, struct block_request, sort_elem)->sector);
+}
+
+/* I/O thread of BLOCK_, a device with an elevator.  Takes batches
+   of requests off the device's queue and carries them out, one
+   batch at a time, so that a device has one request in flight. */
+static void
+queue_thread (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      struct block_request *batch[BATCH_REQS];
+      struct block_iovec iov[BATCH_IOV];
+      const struct block_iovec *iovp;
+      size_t req_cnt, iov_cnt, cnt;
+      size_t i, j;
+
+      lock_acquire (&block->queue_lock);
+      while (list_empty (&block->sorted))
+        cond_wait (&block->queue_nonempty, &block->queue_lock);
+      req_cnt = next_batch (block, batch);
+      lock_release (&block->queue_lock);
+
+      /* A single request goes as it is; a merged batch gets one
+         vector made of its requests' vectors. */
+      if (req_cnt == 1)
+        {
+          iovp = batch[0]->iov;
+          iov_cnt = batch[0]->iov_cnt;
+          cnt = batch[0]->cnt;
+        }
+      else
+        {
+          iovp = iov;
+          iov_cnt = cnt = 0;
+          for (i = 0; i < req_cnt; i++)
+            {
+              for (j = 0; j < batch[i]->iov_cnt; j++)
+                iov[iov_cnt++] = batch[i]->iov[j];
+              cnt += batch[i]->cnt;
+            }
+        }
+      /* Only the first request of a batch can need a seek. */
+      for (i = 0; i < req_cnt; i++)
+        batch[i]->seek = 0;
+      batch[0]->seek = dispatch (block, batch[0]->sector, iovp, iov_cnt,
+                                 batch[0]->write, cnt);
+
+      for (i = 0; i < req_cnt; i++)
+        finish (block, batch[i]);
+    }
+}
+
+/* Takes the next batch of requests off BLOCK's queue, which must
+   not be empty, and stores them into BATCH.  Returns the number
+   of requests taken.
+
+   The first request is the oldest if its deadline has passed.
+   Otherwise it is the one at or next after the sector where the
+   last batch ended, wrapping around to the lowest sector at the
+   end of the disk (C-SCAN).  Requests in the same direction that
+   carry on where the batch ends join it, within limits, so that
+   adjacent requests merge into one device request.  BLOCK's
+   queue lock must be held. */
+static size_t
+next_batch (struct block *block, struct block_request **batch)
+{
+  struct block_request *r, *oldest;
+  struct list_elem *e;
+  size_t req_cnt = 0, iov_cnt = 0, cnt = 0;
+
+  ASSERT (lock_held_by_current_thread (&block->queue_lock));
+  ASSERT (!list_empty (&block->sorted));
+
+  oldest = list_entry (list_front (&block->fifo),
+                       struct block_request, fifo_elem);
+  if (timer_ticks () >= oldest->deadline)
+    r = oldest;
+  else
+    {
+      r = list_entry (list_front (&block->sorted),
+                      struct block_request, sort_elem);
+      for (e = list_begin (&block->sorted); e != list_end (&block->sorted);
+           e = list_next (e))
+        {
+          struct block_request *q = list_entry (e, struct block_request,
+                                                sort_elem);
+          if (q->sector >= block->head)
+            {
+              r = q;
+              break;
+            }
+        }
+    }
+
+  for (;;)
+    {
+      e = list_next (&r->sort_elem);
+      list_remove (&r->sort_elem);
+      list_remove (&r->fifo_elem);
+      batch[req_cnt++] = r;
+      iov_cnt += r->iov_cnt;
+      cnt += r->cnt;
+      block->head = r->sector + r->cnt;
+
+      if (e == list_end (&block->sorted))
+        break;
+      r = list_entry (e, struct block_request, sort_elem);
+      if (r->sector != block->head || r->write != batch[0]->write
+          || req_cnt >= BATCH_REQS || iov_cnt + r->iov_cnt > BATCH_IOV
+          || cnt + r->cnt > BATCH_SECTORS)
+        break;
+    }
+  return req_cnt;
+}
+
+/* Carries out a transfer of CNT sectors starting at SECTOR
+   between BLOCK and the IOV_CNT buffers in IOV, to BLOCK if
+   WRITE, and returns when it is done.  Returns the distance BLOCK
+   had to seek for it. */
+static block_sector_t
+dispatch (struct block *block, block_sector_t sector,
+          const struct block_iovec *iov, size_t iov_cnt, bool write,
+          size_t cnt)
+{
+  const struct block_operations *ops = block->ops;
+  block_sector_t seek;
+  size_t i, j;
+
+  seek = note_access (block, sector, cnt);
+  if (cnt == 1 && iov_cnt == 1)
+    {
+      if (write)
+        ops->write (block->aux, sector, iov[0].buffer);
+      else
+        ops->read (block->aux, sector, iov[0].buffer);
+    }
+  else if (write ? ops->writev != NULL : ops->readv != NULL)
+    (write ? ops->writev : ops->readv) (block->aux, sector, iov, iov_cnt);
+  else
+    for (i = 0; i < iov_cnt; i++)
+      for (j = 0; j < iov[i].cnt; j++)
+        {
+          uint8_t *buffer = (uint8_t *) iov[i].buffer + j * BLOCK_SECTOR_SIZE;
+          if (write)
+            ops->write (block->aux, sector++, buffer);
+          else
+            ops->read (block->aux, sector++, buffer);
+        }
+
+  if (write)
+    block->write_cnt += cnt;
+  else
+    block->read_cnt += cnt;
+  return seek;
+}
+
+/* Adds the distance from the end of the previous access to
+   SECTOR to BLOCK's seek statistics, for an access of CNT
+   sectors, and returns it.  Reading or writing the sector right
+   after the last one counts as no seek. */
+static block_sector_t
+note_access (struct block *block, block_sector_t sector, size_t cnt)
+{
+  block_sector_t seek = (sector > block->next_sector
+                         ? sector - block->next_sector
+                         : block->next_sector - sector);
+  block->seek_total += seek;
+  block->next_sector = sector + cnt;
+  return seek;
+}
+
+/* Adds DELTA to BLOCK's queue depth, first adding the time spent
+   at the old depth to its integral.  BLOCK's queue lock must be
+   held. */
+static void
+change_depth (struct block *block, int delta)
+{
+  uint64_t now = timer_cycles ();
+
+  block->depth_cycles += block->depth * (now - block->depth_since);
+  block->depth_since = now;
+  block->depth += delta;
+  if (block->depth > block->depth_peak)
+    block->depth_peak = block->depth;
+}
+
+/* Returns the blkstat histogram bucket for VALUE. */
+static int
+bucket (uint64_t value)
+{
+  int i;
+
+  for (i = 0; value > 0 && i < BLKSTAT_BUCKETS - 1; i++)
+    value >>= 1;
+  return i;
+}
+
+/* Adds request R, just completed by BLOCK, to BLOCK's statistics
+   for R's class.  BLOCK's queue lock must be held. */
+static void
+account (struct block *block, const struct block_request *r)
+{
+  struct blkstat *s = &block->stats[r->class];
+  uint64_t cycles = timer_cycles () - r->start_cycles;
+  int64_t ticks = timer_ticks () - r->start_ticks;
+
+  s->requests++;
+  if (r->write)
+    s->write_sectors += r->cnt;
+  else
+    s->read_sectors += r->cnt;
+  if (r->seek == 0)
+    s->sequential++;
+  s->seek_total += r->seek;
+  s->cycles_total += cycles;
+  s->ticks_total += ticks;
+  s->cycles_hist[bucket (cycles / BLKSTAT_CYCLES_UNIT)]++;
+  s->ticks_hist[bucket (ticks)]++;
+  s->size_hist[bucket (r->cnt)]++;
+  s->depth_hist[bucket (r->depth)]++;
+}
+
+/* Adds the statistics in SRC to those in DST. */
+static void
+add_stats (struct blkstat *dst, const struct blkstat *src)
+{
+  int i;
+
+  dst->requests += src->requests;
+  dst->read_sectors += src->read_sectors;
+  dst->write_sectors += src->write_sectors;
+  dst->sequential += src->sequential;
+  dst->seek_total += src->seek_total;
+  dst->cycles_total += src->cycles_total;
+  dst->ticks_total += src->ticks_total;
+  for (i = 0; i < BLKSTAT_BUCKETS; i++)
+    {
+      dst->cycles_hist[i] += src->cycles_hist[i];
+      dst->ticks_hist[i] += src->ticks_hist[i];
+      dst->size_hist[i] += src->size_hist[i];
+      dst->depth_hist[i] += src->depth_hist[i];
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,24 +708,136 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Stores into STATS, which has BLKSTAT_CLASS_CNT elements, the
+   I/O statistics of each class of users, summed over all block
+   devices. */
+void
+block_get_stats (struct blkstat *stats)
+{
+  struct list_elem *e;
+  int class;
+
+  memset (stats, 0, BLKSTAT_CLASS_CNT * sizeof *stats);
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
+    {
+      struct block *block = list_entry (e, struct block, list_elem);
+
+      lock_acquire (&block->queue_lock);
+      for (class = 0; class < BLKSTAT_CLASS_CNT; class++)
+        add_stats (&stats[class], &block->stats[class]);
+      lock_release (&block->queue_lock);
+    }
+}
+
+/* Takes BLOCK's queue lock for block_print_stats() and returns
+   true, or returns false if waiting for it is unsafe.  A panic
+   prints statistics with interrupts off, perhaps from an interrupt
+   handler or while some thread holds the lock, so then the lock is
+   only tried. */
+static bool
+lock_for_stats (struct block *block)
+{
+  if (intr_get_level () == INTR_ON)
+    {
+      lock_acquire (&block->queue_lock);
+      return true;
+    }
+  return (!intr_context ()
+          && !lock_held_by_current_thread (&block->queue_lock)
+          && lock_try_acquire (&block->queue_lock));
+}
+
+/* Prints statistics for each block device that has carried out
+   requests, broken down by the class of user.  A device whose
+   lock is busy during a panic is skipped. */
 void
 block_print_stats (void)
 {
-  int i;
+  static const char *class_names[BLKSTAT_CLASS_CNT] =
+    {"kernel", "filesys", "scratch", "swap", "other"};
+  struct list_elem *e;
 
-  for (i = 0; i < BLOCK_CNT; i++)
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks);
+       e = list_next (e))
     {
-      struct block *block = block_by_role[i];
-      if (block != NULL)
+      struct block *block = list_entry (e, struct block, list_elem);
+      unsigned long long access_cnt;
+      uint64_t elapsed, depth;
+      int class;
+
+      /* I/O threads may still be running. */
+      if (!lock_for_stats (block))
+        {
+          printf ("%s: statistics busy\n", block->name);
+          continue;
+        }
+      access_cnt = block->read_cnt + block->write_cnt;
+      if (access_cnt == 0)
+        {
+          lock_release (&block->queue_lock);
+          continue;
+        }
+
+      /* Average depth in hundredths. */
+      change_depth (block, 0);
+      elapsed = block->depth_since - block->start_cycles;
+      depth = elapsed > 0 ? block->depth_cycles * 100 / elapsed : 0;
+      printf ("%s: %llu reads, %llu writes, "
+              "%llu sectors average seek, "
+              "queue depth %llu.%02llu average, %u peak\n",
+              block->name, block->read_cnt, block->write_cnt,
+              block->seek_total / access_cnt,
+              depth / 100, depth % 100, block->depth_peak);
+
+      for (class = 0; class < BLKSTAT_CLASS_CNT; class++)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n",
-                  block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+          const struct blkstat *s = &block->stats[class];
+          if (s->requests == 0)
+            continue;
+          printf ("  %s: %llu requests, %llu%% sequential, "
+                  "%llu sectors read, %llu written, "
+                  "%llu sectors average seek\n",
+                  class_names[class], s->requests,
+                  s->sequential * 100 / s->requests,
+                  s->read_sectors, s->write_sectors,
+                  s->seek_total / s->requests);
+          printf ("    latency: %llu cycles, %llu ticks average\n",
+                  s->cycles_total / s->requests,
+                  s->ticks_total / s->requests);
+          print_histogram ("latency (kcycles)", s->cycles_hist);
+          print_histogram ("latency (ticks)", s->ticks_hist);
+          print_histogram ("size (sectors)", s->size_hist);
+          print_histogram ("queued ahead", s->depth_hist);
         }
+      lock_release (&block->queue_lock);
     }
 }
 
+/* Prints the nonempty buckets of blkstat histogram HIST, labeled
+   NAME. */
+static void
+print_histogram (const char *name, const unsigned *hist)
+{
+  int i;
+
+  printf ("    %s:", name);
+  for (i = 0; i < BLKSTAT_BUCKETS; i++)
+    if (hist[i] != 0)
+      {
+        unsigned long lo = i > 0 ? 1ul << (i - 1) : 0;
+        unsigned long hi = i > 0 ? (1ul << i) - 1 : 0;
+
+        if (i == BLKSTAT_BUCKETS - 1)
+          printf (" %lu+:%u", lo, hist[i]);
+        else if (lo == hi)
+          printf (" %lu:%u", lo, hist[i]);
+        else
+          printf (" %lu-%lu:%u", lo, hi, hist[i]);
+      }
+  printf ("\n");
+}
+
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
@@ -200,6 +860,17 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->seek_total = 0;
+  block->next_sector = 0;
+  lock_init (&block->queue_lock);
+  cond_init (&block->queue_nonempty);
+  list_init (&block->sorted);
+  list_init (&block->fifo);
+  block->head = 0;
+  memset (block->stats, 0, sizeof block->stats);
+  block->depth = block->depth_peak = 0;
+  block->depth_cycles = 0;
+  block->start_cycles = block->depth_since = timer_cycles ();
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -208,6 +879,15 @@ block_register (const char *name, enum block_type type,
     printf (", %s", extra_info);
   printf ("\n");
 
+  if (ops->elevator)
+    {
+      char thread_name[sizeof block->name + 3];
+      snprintf (thread_name, sizeof thread_name, "%s-io", block->name);
+      if (thread_create (thread_name, PRI_DEFAULT, queue_thread, block)
+          == TID_ERROR)
+        PANIC ("Failed to start I/O thread for block device %s", name);
+    }
+
   return block;
 }
 
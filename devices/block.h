@@ -1,8 +1,11 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <list.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -49,22 +52,92 @@ struct block *block_get_by_name (const char *name);
 struct block *block_first (void);
 struct block *block_next (struct block *);
 
+/* One piece of a vectored transfer: CNT sectors at BUFFER.  The
+   pieces of a transfer cover consecutive sectors on the device. */
+struct block_iovec
+  {
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    size_t cnt;                 /* Number of sectors. */
+  };
+
 /* Block device operations. */
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
+void block_readv (struct block *, block_sector_t,
+                  const struct block_iovec *, size_t iov_cnt);
+void block_writev (struct block *, block_sector_t,
+                   const struct block_iovec *, size_t iov_cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* A request to transfer consecutive sectors, starting at SECTOR,
+   between a block device and the IOV_CNT buffers in IOV.
+   Initialize it with block_request_init(), optionally set
+   CALLBACK and AUX, and pass it to block_submit().  When the
+   transfer is done, CALLBACK is called in the device's I/O
+   thread if set; otherwise block_wait() returns. */
+struct block_request
+  {
+    block_sector_t sector;              /* First sector. */
+    const struct block_iovec *iov;      /* Buffers. */
+    size_t iov_cnt;                     /* Number of buffers. */
+    size_t cnt;                         /* Number of sectors in all. */
+    bool write;                         /* To the device? */
+
+    void (*callback) (struct block_request *);
+    void *aux;                          /* For CALLBACK's use. */
+
+    /* Owned by the block layer. */
+    int class;                          /* Class of user, for statistics. */
+    unsigned depth;                     /* Requests ahead of it on arrival. */
+    block_sector_t seek;                /* Distance the device seeked. */
+    uint64_t start_cycles;              /* Cycle count when submitted. */
+    int64_t start_ticks;                /* Timer tick when submitted. */
+    int64_t deadline;                   /* Tick by which to serve it. */
+    struct list_elem sort_elem;         /* Element in queue by sector. */
+    struct list_elem fifo_elem;         /* Element in queue by arrival. */
+    struct semaphore done;              /* Up'd when done, if no callback. */
+  };
+
+void block_request_init (struct block_request *, block_sector_t,
+                         const struct block_iovec *, size_t iov_cnt,
+                         bool write);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+
 /* Statistics. */
+struct blkstat;
+void block_get_stats (struct blkstat *);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
 
+/* READ and WRITE move one sector.  READV and WRITEV, which a
+   driver may leave null, move the sectors of a vectored transfer
+   in as few device commands as the device allows; without them,
+   the block layer falls back to one sector at a time.
+   A driver for a device that lives inside another, such as a
+   partition, provides REMAP instead, which translates a sector
+   number and returns the device to send the request to.
+   A driver for a device that seeks sets ELEVATOR to have requests
+   queued, reordered and merged, and carried out one at a time by
+   an I/O thread; otherwise, requests go to the driver at once, in
+   the submitter's thread. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*readv) (void *aux, block_sector_t,
+                   const struct block_iovec *, size_t iov_cnt);
+    void (*writev) (void *aux, block_sector_t,
+                    const struct block_iovec *, size_t iov_cnt);
+    struct block *(*remap) (void *aux, block_sector_t *);
+    bool elevator;
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -4,14 +4,24 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include "devices/block.h"
+#include <string.h>
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   If the PCI bus has an IDE controller capable of bus mastering,
+   such as the Intel PIIX3 and PIIX4 that QEMU and Bochs emulate,
+   sectors move by DMA while the CPU runs other threads.
+   Otherwise, or if a DMA transfer fails, they move by programmed
+   I/O. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -30,10 +40,27 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE port addresses, relative to the channel's
+   bus master base. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
+#define STA_DF 0x20             /* Device Fault. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus Master Command Register bits. */
+#define BMC_START 0x01          /* Start transfer. */
+#define BMC_READ 0x08           /* Transfer from disk to memory. */
+
+/* Bus Master Status Register bits. */
+#define BMS_ACTIVE 0x01         /* Transfer in progress. */
+#define BMS_ERROR 0x02          /* Transfer failed (write 1 to clear). */
+#define BMS_IRQ 0x04            /* Interrupt raised (write 1 to clear). */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +76,34 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* IDE controller PCI class and subclass, and the programming
+   interface bits we care about. */
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+#define PROG_IF_NATIVE0 0x01    /* Primary channel in native mode. */
+#define PROG_IF_NATIVE1 0x04    /* Secondary channel in native mode. */
+#define PROG_IF_MASTER 0x80     /* Bus master capable. */
+
+/* A physical region descriptor, one entry in the table that
+   tells the bus master where to move a transfer's data.  A
+   region must not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Byte count, 0 for 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the last entry. */
+  };
+
+#define PRD_EOT 0x8000          /* End of table. */
+#define PRD_CNT (PGSIZE / sizeof (struct prd))
+
+/* Most sectors that one ATA command can move, and most that fit
+   in a channel's bounce page. */
+#define MAX_SECTORS 256
+#define BOUNCE_SECTORS (PGSIZE / BLOCK_SECTOR_SIZE)
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +112,7 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool use_dma;               /* Transfer by DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -72,6 +128,13 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master base port, 0 if no DMA. */
+    struct prd *prd;            /* Physical region descriptor table. */
+    void *bounce;               /* DMA buffer for non-kernel memory. */
+    bool dma_active;            /* DMA transfer in progress? */
+    uint8_t dma_status;         /* Bus master status at completion. */
+    uint8_t status;             /* Device status at completion. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -80,15 +143,29 @@ struct channel
 static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
+static void ide_readv (void *, block_sector_t,
+                       const struct block_iovec *, size_t iov_cnt);
+static void ide_writev (void *, block_sector_t,
+                        const struct block_iovec *, size_t iov_cnt);
 
+static uint16_t probe_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
+static void transfer (struct ata_disk *, block_sector_t,
+                      const struct block_iovec *, size_t iov_cnt,
+                      bool write);
+static void pio_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          void *, bool write);
+static bool dma_in_place (const struct block_iovec *, size_t iov_cnt);
+static bool dma_transfer (struct ata_disk *, block_sector_t,
+                          const struct block_iovec *, size_t iov_cnt,
+                          bool write);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
@@ -101,6 +178,7 @@ static void interrupt_handler (struct intr_frame *);
 void
 ide_init (void) 
 {
+  uint16_t bm_base = probe_bus_master ();
   size_t chan_no;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
@@ -126,6 +204,22 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+
+      /* Set up DMA if the controller can do it on this channel. */
+      c->bm_base = 0;
+      c->dma_active = false;
+      if (bm_base != 0)
+        {
+          c->prd = palloc_get_page (0);
+          c->bounce = palloc_get_page (0);
+          if (c->prd != NULL && c->bounce != NULL)
+            c->bm_base = bm_base + chan_no * 8;
+          else
+            {
+              palloc_free_page (c->prd);
+              palloc_free_page (c->bounce);
+            }
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +230,7 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->use_dma = false;
         }
 
       /* Register interrupt handler. */
@@ -159,6 +254,27 @@ ide_init (void)
 
 static char *descramble_ata_string (char *, int size);
 
+/* Looks for a PCI IDE controller that can bus master and that
+   drives both channels at the legacy ports, and enables it.
+   Returns its bus master base port, or 0 if there is none. */
+static uint16_t
+probe_bus_master (void) 
+{
+  struct pci_dev dev;
+  uint16_t base;
+
+  if (!pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &dev)
+      || !(dev.prog_if & PROG_IF_MASTER)
+      || (dev.prog_if & (PROG_IF_NATIVE0 | PROG_IF_NATIVE1)))
+    return 0;
+
+  /* The bus master ports are in BAR 4. */
+  base = pci_io_base (&dev, 4);
+  if (base != 0)
+    pci_enable (&dev, PCI_CMD_IO | PCI_CMD_MASTER);
+  return base;
+}
+
 /* Resets an ATA channel and waits for any devices present on it
    to finish the reset. */
 static void
@@ -284,10 +400,12 @@ identify_ata_device (struct ata_disk *d)
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
+  d->use_dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100);
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\"%s", model, serial,
+            d->use_dma ? ", DMA" : "");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -342,18 +460,13 @@ descramble_ata_string (char *string, int size)
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_read (void *d, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  struct block_iovec iov;
+
+  iov.buffer = buffer;
+  iov.cnt = 1;
+  ide_readv (d, sec_no, &iov, 1);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -362,38 +475,146 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
    Internally synchronizes accesses to disks, so external
    per-disk locking is unneeded. */
 static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+ide_write (void *d, block_sector_t sec_no, const void *buffer)
+{
+  struct block_iovec iov;
+
+  iov.buffer = (void *) buffer;
+  iov.cnt = 1;
+  ide_writev (d, sec_no, &iov, 1);
+}
+
+/* Reads the consecutive sectors starting at SEC_NO from disk D
+   into the IOV_CNT buffers in IOV.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_readv (void *d_, block_sector_t sec_no,
+           const struct block_iovec *iov, size_t iov_cnt)
 {
   struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  lock_acquire (&d->channel->lock);
+  transfer (d, sec_no, iov, iov_cnt, false);
+  lock_release (&d->channel->lock);
+}
+
+/* Writes the IOV_CNT buffers in IOV to the consecutive sectors
+   starting at SEC_NO of disk D.  Returns after the disk has
+   acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_writev (void *d_, block_sector_t sec_no,
+            const struct block_iovec *iov, size_t iov_cnt)
+{
+  struct ata_disk *d = d_;
+  lock_acquire (&d->channel->lock);
+  transfer (d, sec_no, iov, iov_cnt, true);
+  lock_release (&d->channel->lock);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_readv,
+    ide_writev,
+    NULL,
+    true
   };
-
+
+/* Transfers the consecutive sectors starting at SEC_NO between
+   disk D and the IOV_CNT buffers in IOV, from disk to memory
+   unless WRITE.  The caller must hold D's channel lock.
+
+   The whole vector goes in a single DMA command if it fits in
+   one and every buffer can be transferred in place.  Otherwise
+   each piece goes by itself, in commands of up to MAX_SECTORS
+   sectors, or of a page if it must go through the bounce
+   page. */
+static void
+transfer (struct ata_disk *d, block_sector_t sec_no,
+          const struct block_iovec *iov, size_t iov_cnt, bool write)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&d->channel->lock));
+
+  if (d->use_dma && dma_in_place (iov, iov_cnt)
+      && dma_transfer (d, sec_no, iov, iov_cnt, write))
+    return;
+
+  for (i = 0; i < iov_cnt; i++)
+    {
+      uint8_t *buffer = iov[i].buffer;
+      size_t left = iov[i].cnt;
+
+      while (left > 0)
+        {
+          struct block_iovec piece;
+
+          piece.buffer = buffer;
+          piece.cnt = left < MAX_SECTORS ? left : MAX_SECTORS;
+          if (d->use_dma && !dma_in_place (&piece, 1)
+              && piece.cnt > BOUNCE_SECTORS)
+            piece.cnt = BOUNCE_SECTORS;
+          if (!d->use_dma || !dma_transfer (d, sec_no, &piece, 1, write))
+            pio_transfer (d, sec_no, piece.cnt, buffer, write);
+
+          sec_no += piece.cnt;
+          buffer += piece.cnt * BLOCK_SECTOR_SIZE;
+          left -= piece.cnt;
+        }
+    }
+}
+
+/* Transfers CNT sectors, at most MAX_SECTORS, starting at SEC_NO
+   between disk D and BUFFER by programmed I/O, from disk to
+   BUFFER unless WRITE.  The sectors move in one command, with an
+   interrupt per sector. */
+static void
+pio_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *buffer_, bool write)
+{
+  struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+  size_t i;
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_SECTOR_RETRY
+                              : CMD_READ_SECTOR_RETRY);
+  for (i = 0; i < cnt; i++, buffer += BLOCK_SECTOR_SIZE)
+    if (write)
+      {
+        if (!wait_while_busy (d))
+          PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                 d->name, sec_no + i);
+        output_sector (c, buffer);
+        sema_down (&c->completion_wait);
+      }
+    else
+      {
+        sema_down (&c->completion_wait);
+        if (!wait_while_busy (d))
+          PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                 d->name, sec_no + i);
+        input_sector (c, buffer);
+      }
+}
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the count CNT, at most MAX_SECTORS, to the
+   disk's sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt);             /* 0 means 256. */
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -430,6 +651,114 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Returns true if the IOV_CNT buffers in IOV can be transferred
+   in place in one DMA command: they are few enough, hold at most
+   MAX_SECTORS sectors in all, and lie in kernel memory, whose
+   physical addresses we know, at even addresses. */
+static bool
+dma_in_place (const struct block_iovec *iov, size_t iov_cnt) 
+{
+  size_t cnt = 0;
+  size_t i;
+
+  /* A piece of at most MAX_SECTORS sectors spans at most 3
+     regions. */
+  if (iov_cnt > PRD_CNT / 3)
+    return false;
+  for (i = 0; i < iov_cnt; i++)
+    {
+      if (!is_kernel_vaddr (iov[i].buffer) || (uintptr_t) iov[i].buffer % 2)
+        return false;
+      cnt += iov[i].cnt;
+    }
+  return cnt <= MAX_SECTORS;
+}
+
+/* Appends the physical regions for the SIZE bytes at physical
+   address PHYS to channel C's PRD table, which has *PRD_CNT
+   entries so far.  Regions are split at 64 kB boundaries. */
+static void
+add_regions (struct channel *c, size_t *prd_cnt, uintptr_t phys, size_t size)
+{
+  while (size > 0)
+    {
+      struct prd *prd = &c->prd[(*prd_cnt)++];
+      size_t chunk = 0x10000 - (phys & 0xffff);
+
+      ASSERT (*prd_cnt <= PRD_CNT);
+      if (chunk > size)
+        chunk = size;
+      prd->addr = phys;
+      prd->size = chunk & 0xffff;
+      prd->flags = 0;
+      phys += chunk;
+      size -= chunk;
+    }
+}
+
+/* Transfers the consecutive sectors starting at SEC_NO between
+   disk D and the IOV_CNT buffers in IOV by bus master DMA, in one
+   command, from disk to memory unless WRITE.  The buffers must
+   either pass dma_in_place() or be a single piece of at most
+   BOUNCE_SECTORS sectors, which goes through the channel's bounce
+   page.  The caller must hold D's channel lock.  Returns true if
+   successful.  On failure, turns off DMA for D, so that the
+   caller and later requests use PIO instead. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no,
+              const struct block_iovec *iov, size_t iov_cnt, bool write)
+{
+  struct channel *c = d->channel;
+  bool in_place = dma_in_place (iov, iov_cnt);
+  size_t prd_cnt = 0;
+  size_t cnt = 0;
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+
+  /* Describe the physical regions. */
+  if (in_place)
+    for (i = 0; i < iov_cnt; i++)
+      {
+        add_regions (c, &prd_cnt, vtop (iov[i].buffer),
+                     iov[i].cnt * BLOCK_SECTOR_SIZE);
+        cnt += iov[i].cnt;
+      }
+  else
+    {
+      ASSERT (iov_cnt == 1 && iov[0].cnt <= BOUNCE_SECTORS);
+      cnt = iov[0].cnt;
+      if (write)
+        memcpy (c->bounce, iov[0].buffer, cnt * BLOCK_SECTOR_SIZE);
+      add_regions (c, &prd_cnt, vtop (c->bounce), cnt * BLOCK_SECTOR_SIZE);
+    }
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS);
+  c->prd[prd_cnt - 1].flags = PRD_EOT;
+
+  /* Program the bus master, then the disk, then start. */
+  outb (reg_bm_command (c), 0);
+  outb (reg_bm_status (c), inb (reg_bm_status (c)) | BMS_ERROR | BMS_IRQ);
+  outl (reg_bm_prdt (c), vtop (c->prd));
+  outb (reg_bm_command (c), write ? 0 : BMC_READ);
+  select_sector (d, sec_no, cnt);
+  c->dma_active = true;
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), (write ? 0 : BMC_READ) | BMC_START);
+  sema_down (&c->completion_wait);
+
+  if ((c->dma_status & BMS_ERROR) || (c->status & (STA_ERR | STA_DF)))
+    {
+      printf ("%s: DMA %s failed, sector=%"PRDSNu", using PIO\n",
+              d->name, write ? "write" : "read", sec_no);
+      d->use_dma = false;
+      return false;
+    }
+
+  if (!in_place && !write)
+    memcpy (iov[0].buffer, c->bounce, cnt * BLOCK_SECTOR_SIZE);
+  return true;
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -513,7 +842,15 @@ interrupt_handler (struct intr_frame *f)
       {
         if (c->expecting_interrupt) 
           {
-            inb (reg_status (c));               /* Acknowledge interrupt. */
+            if (c->dma_active)
+              {
+                /* Stop the bus master and clear its interrupt. */
+                c->dma_status = inb (reg_bm_status (c));
+                outb (reg_bm_command (c), 0);
+                outb (reg_bm_status (c), c->dma_status | BMS_IRQ);
+                c->dma_active = false;
+              }
+            c->status = inb (reg_status (c));   /* Acknowledge interrupt. */
             sema_up (&c->completion_wait);      /* Wake up waiter. */
           }
         else
@@ -41,6 +41,18 @@ input_getc (void)
   return key;
 }
 
+/* Returns true if the input buffer is empty, false otherwise.
+   Unlike input_full(), this may be called with interrupts on, in
+   which case the answer may be out of date on return. */
+bool
+input_empty (void) 
+{
+  enum intr_level old_level = intr_disable ();
+  bool empty = intq_empty (&buffer);
+  intr_set_level (old_level);
+  return empty;
+}
+
 /* Returns true if the input buffer is full,
    false otherwise.
    Interrupts must be off. */
@@ -0,0 +1,220 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/io.h"
+
+/* The code in this file reads and writes PCI configuration space
+   with configuration mechanism #1, which every PC chipset since
+   the original PCI ones (and QEMU and Bochs) provides.  There is
+   no bus enumeration beyond a brute-force scan: Pintos only needs
+   to find a handful of well-known devices at boot. */
+
+/* Configuration mechanism #1 ports. */
+#define CONFIG_ADDRESS 0xcf8    /* Selects bus, device, function, reg. */
+#define CONFIG_DATA 0xcfc       /* Accesses the selected register. */
+
+/* Header registers used here. */
+#define REG_ID 0x00             /* Device ID:Vendor ID. */
+#define REG_CLASS 0x08          /* Class:Subclass:Prog IF:Revision. */
+#define REG_HEADER 0x0c         /* BIST:Header type:Latency:Cache line. */
+#define REG_IRQ 0x3c            /* Interrupt pin:Interrupt line. */
+
+/* Header type bit for devices with more than one function. */
+#define HEADER_MULTI 0x80
+
+#define BUS_CNT 256
+#define SLOT_CNT 32
+#define FUNC_CNT 8
+
+typedef bool match_func (const struct pci_dev *, uint32_t a, uint32_t b);
+
+static bool scan (match_func *, uint32_t a, uint32_t b, unsigned start,
+                  struct pci_dev *);
+static unsigned position (const struct pci_dev *);
+static uint32_t read_raw (uint8_t bus, uint8_t slot, uint8_t func,
+                          uint8_t reg);
+static uint32_t address (uint8_t bus, uint8_t slot, uint8_t func,
+                         uint8_t reg);
+
+/* Returns true if DEV has vendor A and device ID B. */
+static bool
+match_id (const struct pci_dev *dev, uint32_t a, uint32_t b) 
+{
+  return dev->vendor_id == a && dev->device_id == b;
+}
+
+/* Returns true if DEV has base class A and subclass B. */
+static bool
+match_class (const struct pci_dev *dev, uint32_t a, uint32_t b) 
+{
+  return dev->class == a && dev->subclass == b;
+}
+
+/* Finds the first PCI function with the given VENDOR_ID and
+   DEVICE_ID and stores it into *DEV.  Returns true if
+   successful, false if there is no such function. */
+bool
+pci_find_device (uint16_t vendor_id, uint16_t device_id, struct pci_dev *dev)
+{
+  return scan (match_id, vendor_id, device_id, 0, dev);
+}
+
+/* Finds the next PCI function after *DEV, in the order that
+   pci_find_device() searches, with the given VENDOR_ID and
+   DEVICE_ID, and stores it into *DEV.  Returns true if
+   successful, false if there is no such function. */
+bool
+pci_find_next_device (uint16_t vendor_id, uint16_t device_id,
+                      struct pci_dev *dev)
+{
+  return scan (match_id, vendor_id, device_id, position (dev) + 1, dev);
+}
+
+/* Finds the first PCI function with the given CLASS and SUBCLASS
+   and stores it into *DEV.  Returns true if successful, false if
+   there is no such function. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *dev)
+{
+  return scan (match_class, class, subclass, 0, dev);
+}
+
+/* Returns the 32-bit configuration register REG of DEV.  REG
+   must be a multiple of 4. */
+uint32_t
+pci_read_config (const struct pci_dev *dev, uint8_t reg) 
+{
+  return read_raw (dev->bus, dev->slot, dev->func, reg);
+}
+
+/* Returns the 16-bit configuration register REG of DEV.  REG
+   must be a multiple of 2. */
+uint16_t
+pci_read_config16 (const struct pci_dev *dev, uint8_t reg) 
+{
+  ASSERT (reg % 2 == 0);
+  return pci_read_config (dev, reg & ~3) >> (reg & 2) * 8;
+}
+
+/* Writes VALUE to the 32-bit configuration register REG of DEV.
+   REG must be a multiple of 4. */
+void
+pci_write_config (const struct pci_dev *dev, uint8_t reg, uint32_t value) 
+{
+  enum intr_level old_level = intr_disable ();
+  outl (CONFIG_ADDRESS, address (dev->bus, dev->slot, dev->func, reg));
+  outl (CONFIG_DATA, value);
+  intr_set_level (old_level);
+}
+
+/* Writes VALUE to the 16-bit configuration register REG of DEV.
+   REG must be a multiple of 2. */
+void
+pci_write_config16 (const struct pci_dev *dev, uint8_t reg, uint16_t value) 
+{
+  enum intr_level old_level;
+
+  ASSERT (reg % 2 == 0);
+  old_level = intr_disable ();
+  outl (CONFIG_ADDRESS, address (dev->bus, dev->slot, dev->func, reg));
+  outw (CONFIG_DATA + (reg & 2), value);
+  intr_set_level (old_level);
+}
+
+/* Returns the I/O port base that DEV's base address register BAR
+   decodes, or 0 if BAR is unset or maps memory instead of I/O
+   ports. */
+uint16_t
+pci_io_base (const struct pci_dev *dev, int bar) 
+{
+  uint32_t value;
+
+  ASSERT (bar >= 0 && bar < 6);
+  value = pci_read_config (dev, PCI_REG_BAR0 + bar * 4);
+  return value & 1 ? value & ~3u : 0;
+}
+
+/* Sets the bits in COMMAND, some of PCI_CMD_*, in DEV's command
+   register. */
+void
+pci_enable (const struct pci_dev *dev, uint16_t command) 
+{
+  uint16_t old = pci_read_config16 (dev, PCI_REG_COMMAND);
+  if ((old & command) != command)
+    pci_write_config16 (dev, PCI_REG_COMMAND, old | command);
+}
+
+/* Scans every bus, slot and function, from position START
+   onward, for the first function for which MATCH, passed A and
+   B, returns true, and stores it into *DEV.  Returns true if one
+   was found. */
+static bool
+scan (match_func *match, uint32_t a, uint32_t b, unsigned start,
+      struct pci_dev *dev) 
+{
+  int bus, slot, func;
+
+  for (bus = 0; bus < BUS_CNT; bus++)
+    for (slot = 0; slot < SLOT_CNT; slot++)
+      for (func = 0; func < FUNC_CNT; func++)
+        {
+          uint32_t id = read_raw (bus, slot, func, REG_ID);
+          uint32_t class;
+
+          if ((id & 0xffff) == 0xffff)
+            {
+              /* No function 0 means no device in the slot. */
+              if (func == 0)
+                break;
+              continue;
+            }
+
+          class = read_raw (bus, slot, func, REG_CLASS);
+          dev->bus = bus;
+          dev->slot = slot;
+          dev->func = func;
+          dev->vendor_id = id & 0xffff;
+          dev->device_id = id >> 16;
+          dev->class = class >> 24;
+          dev->subclass = class >> 16;
+          dev->prog_if = class >> 8;
+          dev->irq = read_raw (bus, slot, func, REG_IRQ);
+          if (position (dev) >= start && match (dev, a, b))
+            return true;
+
+          if (func == 0
+              && !(read_raw (bus, slot, 0, REG_HEADER) >> 16 & HEADER_MULTI))
+            break;
+        }
+  return false;
+}
+
+/* Returns DEV's position in the order scan() searches. */
+static unsigned
+position (const struct pci_dev *dev) 
+{
+  return (dev->bus * SLOT_CNT + dev->slot) * FUNC_CNT + dev->func;
+}
+
+/* Reads the 32-bit configuration register REG of function FUNC
+   of device SLOT on bus BUS. */
+static uint32_t
+read_raw (uint8_t bus, uint8_t slot, uint8_t func, uint8_t reg) 
+{
+  enum intr_level old_level = intr_disable ();
+  uint32_t value;
+
+  outl (CONFIG_ADDRESS, address (bus, slot, func, reg));
+  value = inl (CONFIG_DATA);
+  intr_set_level (old_level);
+  return value;
+}
+
+/* Returns the CONFIG_ADDRESS value that selects register REG of
+   function FUNC of device SLOT on bus BUS. */
+static uint32_t
+address (uint8_t bus, uint8_t slot, uint8_t func, uint8_t reg) 
+{
+  ASSERT (slot < SLOT_CNT && func < FUNC_CNT);
+  return (1u << 31) | (bus << 16) | (slot << 11) | (func << 8) | (reg & 0xfc);
+}
@@ -0,0 +1,91 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device kept in kernel memory.
+
+   It has no seek time, so the file system or swap placed on it
+   shows what a policy costs apart from disk latency.  Its
+   contents do not survive a reboot, so it suits only the swap
+   and scratch roles, which it takes by name, e.g. -swap=ram0. */
+
+/* Sectors per page of backing memory. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    void **pages;               /* Backing pages. */
+    size_t page_cnt;            /* Number of pages. */
+  };
+
+static struct block_operations ramdisk_operations;
+
+/* Creates a RAM disk named "ram0" of SIZE bytes, rounded up to a
+   whole number of pages, and registers it as a raw block
+   device. */
+void
+ramdisk_init (size_t size)
+{
+  struct ramdisk *d;
+  size_t i;
+
+  d = malloc (sizeof *d);
+  if (d == NULL)
+    PANIC ("Failed to allocate memory for RAM disk");
+  d->page_cnt = DIV_ROUND_UP (size, PGSIZE);
+  d->pages = malloc (d->page_cnt * sizeof *d->pages);
+  if (d->pages == NULL)
+    PANIC ("Failed to allocate memory for RAM disk");
+  for (i = 0; i < d->page_cnt; i++)
+    {
+      d->pages[i] = palloc_get_page (PAL_ZERO);
+      if (d->pages[i] == NULL)
+        PANIC ("RAM disk: out of memory after %zu of %zu pages",
+               i, d->page_cnt);
+    }
+
+  block_register ("ram0", BLOCK_RAW, NULL, d->page_cnt * SECTORS_PER_PAGE,
+                  &ramdisk_operations, d);
+}
+
+/* Returns the address of SECTOR within RAM disk D. */
+static uint8_t *
+sector_addr (struct ramdisk *d, block_sector_t sector)
+{
+  ASSERT (sector / SECTORS_PER_PAGE < d->page_cnt);
+  return ((uint8_t *) d->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads sector SEC_NO from RAM disk D_ into BUFFER. */
+static void
+ramdisk_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  memcpy (buffer, sector_addr (d_, sec_no), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes sector SEC_NO to RAM disk D_ from BUFFER. */
+static void
+ramdisk_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  memcpy (sector_addr (d_, sec_no), buffer, BLOCK_SECTOR_SIZE);
+}
+
+/* Without seeks there is nothing for an elevator to gain, so
+   requests are copied in the submitter's thread. */
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    NULL,
+    NULL,
+    NULL,
+    false
+  };
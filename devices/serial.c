@@ -1,7 +1,7 @@
 #include "devices/serial.h"
 #include <debug.h>
+#include <stdio.h>
 #include "devices/input.h"
-#include "devices/intq.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
@@ -33,6 +33,17 @@
 #define MCR_REG (IO_BASE + 4)   /* MODEM Control Register. */
 #define LSR_REG (IO_BASE + 5)   /* Line Status Register (read-only). */
 
+/* Interrupt Identification Register bits. */
+#define IIR_FIFO 0xc0           /* FIFOs enabled. */
+
+/* FIFO Control Register bits. */
+#define FCR_ENABLE 0x01         /* Enable FIFOs. */
+#define FCR_CLEAR_RX 0x02       /* Clear receive FIFO. */
+#define FCR_CLEAR_TX 0x04       /* Clear transmit FIFO. */
+
+/* Bytes the 16550A's transmit FIFO holds. */
+#define TX_FIFO_SIZE 16
+
 /* Interrupt Enable Register bits. */
 #define IER_RECV 0x01           /* Interrupt when data received. */
 #define IER_XMIT 0x02           /* Interrupt when transmit finishes. */
@@ -51,9 +62,35 @@
 /* Transmission mode. */
 static enum { UNINIT, POLL, QUEUE } mode;
 
-/* Data to be transmitted. */
-static struct intq txq;
-
+/* Data to be transmitted, in a ring with one producer and one
+   consumer.  The producer is serial_putc(), which advances only
+   TX_HEAD; callers in threads and interrupt handlers take turns
+   at it by turning interrupts off for the few instructions it
+   takes to add a byte.  The consumer is the transmit interrupt,
+   which advances only TX_TAIL as it fills the UART's FIFO in
+   bursts, so neither side ever waits for the other.  Both
+   indexes run freely and wrap modulo TXBUF_SIZE. */
+#define TXBUF_SIZE 16384
+static uint8_t txbuf[TXBUF_SIZE];
+static volatile unsigned tx_head, tx_tail;
+
+/* Bytes the UART accepts once it reports THR empty: the size of
+   its transmit FIFO, or 1 if it has none. */
+static int tx_burst = 1;
+
+/* Last value written to the interrupt enable register. */
+static uint8_t ier;
+
+/* -serial-lossy: Drop output when the ring is full, rather than
+   sending a byte by polling to make room? */
+bool serial_lossy;
+
+/* Bytes dropped for want of room, in lossy mode. */
+static long long drop_cnt;
+
+static bool txbuf_empty (void);
+static bool txbuf_full (void);
+static uint8_t txbuf_getc (void);
 static void set_serial (int bps);
 static void putc_poll (uint8_t);
 static void write_ier (void);
@@ -68,10 +105,13 @@ init_poll (void)
 {
   ASSERT (mode == UNINIT);
   outb (IER_REG, 0);                    /* Turn off all interrupts. */
-  outb (FCR_REG, 0);                    /* Disable FIFO. */
+  outb (FCR_REG, FCR_ENABLE | FCR_CLEAR_RX | FCR_CLEAR_TX);
+  if ((inb (IIR_REG) & IIR_FIFO) == IIR_FIFO)
+    tx_burst = TX_FIFO_SIZE;            /* 16550A with working FIFO. */
+  else
+    outb (FCR_REG, 0);                  /* Older UART: no FIFO. */
   set_serial (9600);                    /* 9.6 kbps, N-8-1. */
   outb (MCR_REG, MCR_OUT2);             /* Required to enable interrupts. */
-  intq_init (&txq);
   mode = POLL;
 } 
 
@@ -108,22 +148,26 @@ serial_putc (uint8_t byte)
         init_poll ();
       putc_poll (byte); 
     }
-  else 
+  else if (txbuf_full () && serial_lossy)
+    drop_cnt++;
+  else
     {
-      /* Otherwise, queue a byte and update the interrupt enable
-         register. */
-      if (old_level == INTR_OFF && intq_full (&txq)) 
+      if (txbuf_full ()) 
         {
-          /* Interrupts are off and the transmit queue is full.
-             If we wanted to wait for the queue to empty,
-             we'd have to reenable interrupts.
-             That's impolite, so we'll send a character via
-             polling instead. */
-          putc_poll (intq_getc (&txq)); 
+          /* The ring is full.  With interrupts off the transmit
+             interrupt cannot drain it, so send the oldest byte
+             via polling to make room instead of losing any. */
+          putc_poll (txbuf_getc ()); 
         }
 
-      intq_putc (&txq, byte); 
-      write_ier ();
+      /* Store the byte before publishing it, then make sure the
+         transmit interrupt is on.  The interrupt enable register
+         only needs writing when the ring was empty. */
+      txbuf[tx_head % TXBUF_SIZE] = byte;
+      barrier ();
+      tx_head++;
+      if (!(ier & IER_XMIT))
+        write_ier ();
     }
   
   intr_set_level (old_level);
@@ -135,11 +179,18 @@ void
 serial_flush (void) 
 {
   enum intr_level old_level = intr_disable ();
-  while (!intq_empty (&txq))
-    putc_poll (intq_getc (&txq));
+  while (!txbuf_empty ())
+    putc_poll (txbuf_getc ());
   intr_set_level (old_level);
 }
 
+/* Prints serial statistics. */
+void
+serial_print_stats (void) 
+{
+  printf ("Serial: %lld bytes dropped\n", drop_cnt);
+}
+
 /* The fullness of the input buffer may have changed.  Reassess
    whether we should block receive interrupts.
    Called by the input buffer routines when characters are added
@@ -176,13 +227,13 @@ set_serial (int bps)
 static void
 write_ier (void) 
 {
-  uint8_t ier = 0;
-
   ASSERT (intr_get_level () == INTR_OFF);
 
+  ier = 0;
+
   /* Enable transmit interrupt if we have any characters to
      transmit. */
-  if (!intq_empty (&txq))
+  if (!txbuf_empty ())
     ier |= IER_XMIT;
 
   /* Enable receive interrupt if we have room to store any
@@ -218,11 +269,45 @@ serial_interrupt (struct intr_frame *f UNUSED)
   while (!input_full () && (inb (LSR_REG) & LSR_DR) != 0)
     input_putc (inb (RBR_REG));
 
-  /* As long as we have a byte to transmit, and the hardware is
-     ready to accept a byte for transmission, transmit a byte. */
-  while (!intq_empty (&txq) && (inb (LSR_REG) & LSR_THRE) != 0) 
-    outb (THR_REG, intq_getc (&txq));
+  /* Once the hardware is ready to accept bytes for transmission,
+     fill its FIFO from the ring in one burst. */
+  if ((inb (LSR_REG) & LSR_THRE) != 0) 
+    {
+      int i;
+
+      for (i = 0; i < tx_burst && !txbuf_empty (); i++)
+        outb (THR_REG, txbuf_getc ());
+    }
 
   /* Update interrupt enable register based on queue status. */
   write_ier ();
 }
+
+/* Returns true if the transmit ring is empty. */
+static bool
+txbuf_empty (void) 
+{
+  return tx_head == tx_tail;
+}
+
+/* Returns true if the transmit ring is full. */
+static bool
+txbuf_full (void) 
+{
+  return tx_head - tx_tail == TXBUF_SIZE;
+}
+
+/* Removes and returns the oldest byte in the transmit ring,
+   which must not be empty.  Only the consumer may call this: the
+   transmit interrupt, or a caller with interrupts off. */
+static uint8_t
+txbuf_getc (void) 
+{
+  uint8_t byte;
+
+  ASSERT (!txbuf_empty ());
+  byte = txbuf[tx_tail % TXBUF_SIZE];
+  barrier ();
+  tx_tail++;
+  return byte;
+}
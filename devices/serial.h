@@ -1,11 +1,17 @@
 #ifndef DEVICES_SERIAL_H
 #define DEVICES_SERIAL_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
+/* Drop output rather than wait when the buffer is full?
+   Defaults to false, which loses nothing. */
+extern bool serial_lossy;
+
 void serial_init_queue (void);
 void serial_putc (uint8_t);
 void serial_flush (void);
 void serial_notify (void);
+void serial_print_stats (void);
 
 #endif /* devices/serial.h */
@@ -1,10 +1,12 @@
 #include "devices/shutdown.h"
 #include <console.h>
+#include <klog.h>
 #include <stdio.h>
 #include "devices/kbd.h"
 #include "devices/serial.h"
 #include "devices/timer.h"
 #include "threads/io.h"
+#include "threads/palloc.h"
 #include "threads/thread.h"
 #ifdef USERPROG
 #include "userprog/exception.h"
@@ -12,6 +14,12 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "filesys/filesys.h"
+#include "filesys/dcache.h"
+#include "filesys/journal.h"
+#endif
+#ifdef VM
+#include "vm/merge.h"
+#include "vm/pagecache.h"
 #endif
 
 /* Keyboard control register port. */
@@ -94,6 +102,7 @@ shutdown_power_off (void)
   filesys_done ();
 #endif
 
+  klog_flush ();
   print_stats ();
 
   printf ("Powering off...\n");
@@ -120,12 +129,21 @@ print_stats (void)
 {
   timer_print_stats ();
   thread_print_stats ();
+  palloc_print_stats ();
 #ifdef FILESYS
   block_print_stats ();
+  journal_print_stats ();
+  dcache_print_stats ();
 #endif
   console_print_stats ();
+  klog_print_stats ();
+  serial_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+#ifdef VM
+  merge_print_stats ();
+  pagecache_print_stats ();
+#endif
 }
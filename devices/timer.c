@@ -24,9 +24,25 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Time-stamp counter frequency in Hz, measured against the timer
+   by timer_calibrate(), or 0 until then.  Once it is known,
+   timestamps and brief delays come from the TSC, which resolves
+   far finer than a timer tick. */
+static uint64_t tsc_hz;
+
+/* TSC value and tick count at the same moment, from which
+   timer_ns() counts. */
+static uint64_t tsc_base;
+static int64_t tsc_base_ticks;
+
+/* Timer ticks over which to measure the TSC. */
+#define TSC_CALIBRATE_TICKS 10
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
+static void calibrate_tsc (void);
+static void wait_for_tick (void);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
 
@@ -39,7 +55,9 @@ timer_init (void)
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Calibrates loops_per_tick, used to implement brief delays,
+   and then the TSC frequency, used for timestamps and, once
+   known, for brief delays instead. */
 void
 timer_calibrate (void) 
 {
@@ -64,6 +82,27 @@ timer_calibrate (void)
       loops_per_tick |= test_bit;
 
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  calibrate_tsc ();
+}
+
+/* Returns the number of nanoseconds since the OS booted.  The
+   result never decreases.  It has the resolution of the TSC once
+   timer_calibrate() has run, and of a timer tick before. */
+int64_t
+timer_ns (void) 
+{
+  uint64_t cycles;
+
+  if (tsc_hz == 0)
+    return timer_ticks () * (1000 * 1000 * 1000 / TIMER_FREQ);
+
+  /* Split the division to keep the multiplication from
+     overflowing. */
+  cycles = timer_cycles () - tsc_base;
+  return (tsc_base_ticks * (1000 * 1000 * 1000 / TIMER_FREQ)
+          + cycles / tsc_hz * 1000 * 1000 * 1000
+          + cycles % tsc_hz * 1000 * 1000 * 1000 / tsc_hz);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -174,15 +213,52 @@ timer_interrupt (struct intr_frame *args UNUSED)
   thread_tick ();
 }
 
+/* Measures the TSC frequency over TSC_CALIBRATE_TICKS timer
+   ticks.  Leaves tsc_hz at 0, so that the loop calibration stays
+   in use, if the TSC does not seem to run. */
+static void
+calibrate_tsc (void) 
+{
+  uint64_t start, end;
+  int64_t start_ticks;
+
+  printf ("Calibrating TSC...  ");
+  wait_for_tick ();
+  start = timer_cycles ();
+  start_ticks = ticks;
+  while (ticks - start_ticks < TSC_CALIBRATE_TICKS)
+    barrier ();
+  end = timer_cycles ();
+
+  if (end <= start)
+    {
+      printf ("not running.\n");
+      return;
+    }
+  tsc_base = end;
+  tsc_base_ticks = start_ticks + TSC_CALIBRATE_TICKS;
+  tsc_hz = (end - start) * TIMER_FREQ / TSC_CALIBRATE_TICKS;
+  printf ("%'"PRIu64" Hz.\n", tsc_hz);
+}
+
+/* Waits for the next timer tick to begin. */
+static void
+wait_for_tick (void) 
+{
+  int64_t start = ticks;
+  while (ticks == start)
+    barrier ();
+}
+
 /* Returns true if LOOPS iterations waits for more than one timer
    tick, otherwise false. */
 static bool
 too_many_loops (unsigned loops) 
 {
+  int64_t start;
+
   /* Wait for a timer tick. */
-  int64_t start = ticks;
-  while (ticks == start)
-    barrier ();
+  wait_for_tick ();
 
   /* Run LOOPS loops. */
   start = ticks;
@@ -242,5 +318,17 @@ real_time_delay (int64_t num, int32_t denom)
   /* Scale the numerator and denominator down by 1000 to avoid
      the possibility of overflow. */
   ASSERT (denom % 1000 == 0);
-  busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000)); 
+  if (tsc_hz != 0)
+    {
+      /* Watch the TSC, which does not depend on how the loop
+         happens to be aligned or on the loops calibration's
+         rounding. */
+      uint64_t start = timer_cycles ();
+      uint64_t cycles = num * (tsc_hz / 1000) / (denom / 1000);
+
+      while (timer_cycles () - start < cycles)
+        barrier ();
+    }
+  else
+    busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000)); 
 }
@@ -12,6 +12,17 @@ void timer_calibrate (void);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
+int64_t timer_ns (void);
+
+/* Returns the CPU's time-stamp counter, which counts clock
+   cycles. */
+static inline uint64_t
+timer_cycles (void) 
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
 
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
@@ -0,0 +1,178 @@
+#include "devices/tty.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include <ttymode.h>
+#include "devices/input.h"
+#include "threads/synch.h"
+
+/* Line discipline for the console, between the raw keys in the
+   input buffer and processes reading standard input.
+
+   In canonical mode, keys are collected into a line, which may
+   be edited with backspace and Ctrl+U, and a read returns only
+   once a whole line, ending in a new-line, is ready.  A large
+   read takes the line in one system call; a small one takes it
+   piece by piece.  Ctrl+D on an empty line reads as end of file.
+
+   In raw mode, a read waits for one key and returns it along
+   with any others already typed, unedited.
+
+   With echo on, keys are echoed to the console as they are
+   typed, so that programs need not echo them one at a time. */
+
+/* Longest line, including its new-line. */
+#define LINE_SIZE TTY_LINE_MAX
+
+#define CTRL(C) ((C) - 'A' + 1)
+
+/* Current mode, some of TTY_*. */
+static int mode = TTY_DEFAULT;
+
+/* Serializes readers, and protects the line. */
+static struct lock tty_lock;
+
+/* Line being edited, or, once READY, being read. */
+static char line[LINE_SIZE];
+static size_t line_len;         /* Bytes in LINE. */
+static size_t read_ofs;         /* Bytes of a ready LINE already read. */
+static bool ready;              /* LINE is complete. */
+
+static void edit (char c);
+static void clear_line (void);
+static void echo (const char *, size_t);
+
+/* Initializes the line discipline. */
+void
+tty_init (void) 
+{
+  lock_init (&tty_lock);
+}
+
+/* Reads up to SIZE bytes of console input into BUFFER, according
+   to the current mode, and returns the number of bytes read.
+   Returns 0 at end of file.
+
+   BUFFER may be user memory, whose page faults may kill the
+   process, so input is gathered in a kernel buffer and copied to
+   BUFFER only after tty_lock is released.  A read therefore
+   returns at most LINE_SIZE bytes, which is still a whole line in
+   canonical mode. */
+size_t
+tty_read (void *buffer, size_t size) 
+{
+  char kbuf[LINE_SIZE];
+  size_t n = 0;
+
+  if (size == 0)
+    return 0;
+  if (size > LINE_SIZE)
+    size = LINE_SIZE;
+
+  lock_acquire (&tty_lock);
+  if (mode & TTY_CANON)
+    {
+      while (!ready)
+        edit (input_getc ());
+
+      /* Hand over as much of the line as fits. */
+      for (n = 0; n < size && read_ofs < line_len; n++)
+        kbuf[n] = line[read_ofs++];
+      if (read_ofs == line_len)
+        clear_line ();
+    }
+  else
+    {
+      /* Wait for one key, then take whatever else is there. */
+      do
+        {
+          kbuf[n] = input_getc ();
+          echo (&kbuf[n], 1);
+          n++;
+        }
+      while (n < size && !input_empty ());
+    }
+  lock_release (&tty_lock);
+
+  memcpy (buffer, kbuf, n);
+  return n;
+}
+
+/* Sets the console mode to MODE, some of TTY_*, and returns the
+   previous mode.  Leaving canonical mode discards a partial
+   line. */
+int
+tty_set_mode (int new_mode) 
+{
+  int old_mode;
+
+  lock_acquire (&tty_lock);
+  old_mode = mode;
+  mode = new_mode & (TTY_CANON | TTY_ECHO);
+  if (!(mode & TTY_CANON))
+    clear_line ();
+  lock_release (&tty_lock);
+
+  return old_mode;
+}
+
+/* Applies key C to the line being edited in canonical mode. */
+static void
+edit (char c) 
+{
+  switch (c) 
+    {
+    case '\r':
+    case '\n':
+      line[line_len++] = '\n';
+      echo ("\n", 1);
+      ready = true;
+      break;
+
+    case '\b':
+    case 0x7f:                  /* Delete. */
+      if (line_len > 0)
+        {
+          line_len--;
+          echo ("\b \b", 3);
+        }
+      break;
+
+    case CTRL ('U'):
+      for (; line_len > 0; line_len--)
+        echo ("\b \b", 3);
+      break;
+
+    case CTRL ('D'):
+      /* End of file on an empty line, otherwise the end of a
+         line without a new-line. */
+      ready = true;
+      break;
+
+    default:
+      /* Keep room for the new-line. */
+      if (line_len < LINE_SIZE - 1)
+        {
+          line[line_len++] = c;
+          echo (&c, 1);
+        }
+      break;
+    }
+}
+
+/* Empties the line. */
+static void
+clear_line (void) 
+{
+  ready = false;
+  line_len = read_ofs = 0;
+}
+
+/* Echoes the SIZE bytes in BUFFER to the console, if echo is
+   on. */
+static void
+echo (const char *buffer, size_t size) 
+{
+  if (mode & TTY_ECHO)
+    putbuf (buffer, size);
+}
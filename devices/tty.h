@@ -0,0 +1,10 @@
+#ifndef DEVICES_TTY_H
+#define DEVICES_TTY_H
+
+#include <stddef.h>
+
+void tty_init (void);
+size_t tty_read (void *, size_t);
+int tty_set_mode (int mode);
+
+#endif /* devices/tty.h */
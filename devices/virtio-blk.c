@@ -0,0 +1,441 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* The code in this file is a driver for virtio block devices,
+   such as QEMU attaches with "-drive if=virtio".  It speaks the
+   legacy virtio PCI interface, which transitional devices (QEMU's
+   default) also provide, through I/O ports in BAR 0.
+
+   Unlike an IDE channel, a virtio disk takes many requests at
+   once.  Each request is a chain of descriptors in a shared ring,
+   the virtqueue, pointing straight at the caller's buffers, so a
+   whole page moves with one notification and one interrupt rather
+   than a port access per word.  Requests are carried out in the
+   submitter's thread, so each thread blocked on I/O can have a
+   request in flight. */
+
+/* PCI IDs of a transitional virtio block device. */
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+/* Legacy interface registers, as offsets from the I/O base. */
+#define REG_DEVICE_FEATURES 0x00        /* Features the device offers. */
+#define REG_GUEST_FEATURES 0x04         /* Features the driver accepts. */
+#define REG_QUEUE_PFN 0x08              /* Page number of virtqueue. */
+#define REG_QUEUE_SIZE 0x0c             /* Virtqueue entries (16 bits). */
+#define REG_QUEUE_SELECT 0x0e           /* Selects a virtqueue (16 bits). */
+#define REG_QUEUE_NOTIFY 0x10           /* Kicks a virtqueue (16 bits). */
+#define REG_STATUS 0x12                 /* Device status (8 bits). */
+#define REG_ISR 0x13                    /* Interrupt status (8 bits). */
+#define REG_CAPACITY 0x14               /* Capacity in sectors (64 bits). */
+
+/* Device status bits. */
+#define STA_ACKNOWLEDGE 0x01            /* Driver found the device. */
+#define STA_DRIVER 0x02                 /* Driver knows how to drive it. */
+#define STA_DRIVER_OK 0x04              /* Driver is ready. */
+
+/* Descriptor flags. */
+#define DESC_NEXT 0x1                   /* Chain continues in NEXT. */
+#define DESC_WRITE 0x2                  /* Device writes the buffer. */
+
+/* Request types and the status that reports success. */
+#define REQ_IN 0                        /* Read. */
+#define REQ_OUT 1                       /* Write. */
+#define REQ_OK 0
+
+/* The legacy interface aligns the used ring to this boundary. */
+#define RING_ALIGN 4096
+
+/* Each request owns a fixed run of descriptors, enough for a
+   header, SLOT_SEGS data buffers and a status byte. */
+#define SLOT_SEGS 14
+#define SLOT_DESCS (SLOT_SEGS + 2)
+#define MAX_SLOTS 32
+
+/* A virtqueue descriptor. */
+struct vring_desc
+  {
+    uint64_t addr;                      /* Physical address. */
+    uint32_t len;                       /* Length in bytes. */
+    uint16_t flags;                     /* DESC_* flags. */
+    uint16_t next;                      /* Next descriptor in chain. */
+  };
+
+/* Ring of descriptor chains offered to the device. */
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;                       /* Next entry the driver fills. */
+    uint16_t ring[];                    /* Heads of chains. */
+  };
+
+/* Ring of descriptor chains the device has finished. */
+struct vring_used_elem
+  {
+    uint32_t id;                        /* Head of chain. */
+    uint32_t len;                       /* Bytes written to it. */
+  };
+
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;                       /* Next entry the device fills. */
+    struct vring_used_elem ring[];
+  };
+
+/* Request header, read by the device. */
+struct request_header
+  {
+    uint32_t type;                      /* REQ_IN or REQ_OUT. */
+    uint32_t reserved;
+    uint64_t sector;                    /* First sector. */
+  };
+
+/* A request in flight.  It lives on its submitter's stack, which
+   the device reaches by physical address like any kernel
+   memory. */
+struct request
+  {
+    struct request_header header;       /* Read by the device. */
+    uint8_t status;                     /* Written by the device. */
+    struct semaphore done;              /* Upped on completion. */
+  };
+
+/* A virtio disk. */
+struct virtio_disk
+  {
+    char name[8];                       /* Name, e.g. "vda". */
+    uint16_t reg_base;                  /* Base I/O port. */
+    uint8_t irq;                        /* Interrupt vector. */
+
+    /* Virtqueue, shared with the device. */
+    uint16_t queue_size;                /* Number of descriptors. */
+    struct vring_desc *desc;            /* Descriptor table. */
+    struct vring_avail *avail;          /* Available ring. */
+    volatile struct vring_used *used;   /* Used ring. */
+    uint16_t last_used;                 /* Used entries consumed. */
+
+    /* Request slots.  SLOT_BUSY and SLOTS change only with
+       interrupts off. */
+    size_t slot_cnt;                    /* Number of slots. */
+    struct semaphore free_slots;        /* Counts free slots. */
+    uint32_t slot_busy;                 /* Bitmap of slots in use. */
+    struct request *slots[MAX_SLOTS];   /* Request in each slot. */
+  };
+
+/* Disks, which all share one interrupt handler, since PCI
+   devices may share an interrupt line. */
+#define MAX_DISKS 4
+static struct virtio_disk disks[MAX_DISKS];
+static size_t disk_cnt;
+
+static struct block_operations virtio_operations;
+
+static bool setup_queue (struct virtio_disk *, const struct pci_dev *);
+static void register_disk (struct virtio_disk *);
+static void transfer (struct virtio_disk *, block_sector_t,
+                      const struct block_iovec *, size_t iov_cnt,
+                      bool write);
+static void submit (struct virtio_disk *, block_sector_t,
+                    const struct block_iovec *, size_t iov_cnt, bool write);
+static intr_handler_func interrupt_handler;
+
+/* Finds virtio block devices and registers each one, and its
+   partitions, as block devices named "vda", "vdb", and so on. */
+void
+virtio_blk_init (void)
+{
+  const uint16_t vendor = VIRTIO_VENDOR_ID, device = VIRTIO_BLK_DEVICE_ID;
+  struct pci_dev dev;
+  bool found;
+
+  for (found = pci_find_device (vendor, device, &dev);
+       found && disk_cnt < MAX_DISKS;
+       found = pci_find_next_device (vendor, device, &dev))
+    {
+      struct virtio_disk *d = &disks[disk_cnt];
+
+      snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+      if (!setup_queue (d, &dev))
+        continue;
+
+      /* Count the disk before reading its partition table, so
+         that the interrupt handler looks at its queue. */
+      disk_cnt++;
+      register_disk (d);
+    }
+}
+
+/* Resets the device DEV, sets up its virtqueue for disk D, and
+   tells it the driver is ready.  Returns true if successful,
+   false if DEV cannot be used. */
+static bool
+setup_queue (struct virtio_disk *d, const struct pci_dev *dev)
+{
+  size_t desc_size, used_ofs, page_cnt;
+  uint16_t reg_base;
+  uint8_t *ring;
+  size_t i;
+
+  reg_base = pci_io_base (dev, 0);
+  if (reg_base == 0 || dev->irq >= 16)
+    {
+      printf ("%s: no I/O ports or interrupt line, ignoring\n", d->name);
+      return false;
+    }
+  pci_enable (dev, PCI_CMD_IO | PCI_CMD_MASTER);
+  d->reg_base = reg_base;
+  d->irq = dev->irq + 0x20;
+
+  /* Reset, then accept none of the optional features. */
+  outb (reg_base + REG_STATUS, 0);
+  outb (reg_base + REG_STATUS, STA_ACKNOWLEDGE);
+  outb (reg_base + REG_STATUS, STA_ACKNOWLEDGE | STA_DRIVER);
+  outl (reg_base + REG_GUEST_FEATURES, 0);
+
+  /* The legacy interface fixes the queue size, so the rings must
+     be laid out the way the device expects. */
+  outw (reg_base + REG_QUEUE_SELECT, 0);
+  d->queue_size = inw (reg_base + REG_QUEUE_SIZE);
+  if (d->queue_size < SLOT_DESCS)
+    {
+      printf ("%s: virtqueue of %"PRIu16" entries too small, ignoring\n",
+              d->name, d->queue_size);
+      return false;
+    }
+  desc_size = d->queue_size * sizeof *d->desc;
+  used_ofs = ROUND_UP (desc_size + sizeof *d->avail
+                       + (d->queue_size + 1) * sizeof *d->avail->ring,
+                       RING_ALIGN);
+  page_cnt = DIV_ROUND_UP (used_ofs + sizeof *d->used
+                           + d->queue_size * sizeof *d->used->ring
+                           + sizeof (uint16_t), PGSIZE);
+  ring = palloc_get_multiple (PAL_ZERO, page_cnt);
+  if (ring == NULL)
+    {
+      printf ("%s: out of memory for virtqueue, ignoring\n", d->name);
+      return false;
+    }
+  d->desc = (struct vring_desc *) ring;
+  d->avail = (struct vring_avail *) (ring + desc_size);
+  d->used = (struct vring_used *) (ring + used_ofs);
+  d->last_used = 0;
+
+  /* Chain each slot's descriptors together once and for all. */
+  d->slot_cnt = d->queue_size / SLOT_DESCS;
+  if (d->slot_cnt > MAX_SLOTS)
+    d->slot_cnt = MAX_SLOTS;
+  for (i = 0; i < d->slot_cnt * SLOT_DESCS; i++)
+    d->desc[i].next = i + 1;
+  sema_init (&d->free_slots, d->slot_cnt);
+  d->slot_busy = 0;
+
+  /* The disks found so far are DISKS[0...DISK_CNT). */
+  for (i = 0; i < disk_cnt; i++)
+    if (disks[i].irq == d->irq)
+      break;
+  if (i == disk_cnt)
+    intr_register_ext (d->irq, interrupt_handler, "virtio-blk");
+  outl (reg_base + REG_QUEUE_PFN, vtop (ring) >> PGBITS);
+  outb (reg_base + REG_STATUS,
+        STA_ACKNOWLEDGE | STA_DRIVER | STA_DRIVER_OK);
+  return true;
+}
+
+/* Registers disk D, whose queue is set up, and scans it for
+   partitions. */
+static void
+register_disk (struct virtio_disk *d)
+{
+  uint32_t capacity_lo = inl (d->reg_base + REG_CAPACITY);
+  uint32_t capacity_hi = inl (d->reg_base + REG_CAPACITY + 4);
+  block_sector_t capacity = capacity_hi != 0 ? UINT32_MAX : capacity_lo;
+  char extra_info[64];
+  struct block *block;
+
+  snprintf (extra_info, sizeof extra_info,
+            "virtio, %zu requests of %d segments",
+            d->slot_cnt, SLOT_SEGS);
+  block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
+                          &virtio_operations, d);
+  partition_scan (block);
+}
+
+/* Reads sector SEC_NO from disk D_ into BUFFER, which must have
+   room for BLOCK_SECTOR_SIZE bytes. */
+static void
+virtio_read (void *d_, block_sector_t sec_no, void *buffer)
+{
+  struct block_iovec iov;
+
+  iov.buffer = buffer;
+  iov.cnt = 1;
+  transfer (d_, sec_no, &iov, 1, false);
+}
+
+/* Writes sector SEC_NO to disk D_ from BUFFER, which must
+   contain BLOCK_SECTOR_SIZE bytes. */
+static void
+virtio_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  struct block_iovec iov;
+
+  iov.buffer = (void *) buffer;
+  iov.cnt = 1;
+  transfer (d_, sec_no, &iov, 1, true);
+}
+
+/* Reads consecutive sectors starting at SEC_NO from disk D_
+   into the IOV_CNT buffers in IOV. */
+static void
+virtio_readv (void *d_, block_sector_t sec_no,
+              const struct block_iovec *iov, size_t iov_cnt)
+{
+  transfer (d_, sec_no, iov, iov_cnt, false);
+}
+
+/* Writes consecutive sectors starting at SEC_NO to disk D_ from
+   the IOV_CNT buffers in IOV. */
+static void
+virtio_writev (void *d_, block_sector_t sec_no,
+               const struct block_iovec *iov, size_t iov_cnt)
+{
+  transfer (d_, sec_no, iov, iov_cnt, true);
+}
+
+/* The device orders requests itself, so they go straight to it
+   from the submitter's thread rather than through an elevator,
+   and several threads' requests can be in flight at once. */
+static struct block_operations virtio_operations =
+  {
+    virtio_read,
+    virtio_write,
+    virtio_readv,
+    virtio_writev,
+    NULL,
+    false
+  };
+
+/* Transfers consecutive sectors starting at SEC_NO between disk
+   D and the IOV_CNT buffers in IOV, to D if WRITE, in requests of
+   up to SLOT_SEGS buffers each. */
+static void
+transfer (struct virtio_disk *d, block_sector_t sec_no,
+          const struct block_iovec *iov, size_t iov_cnt, bool write)
+{
+  while (iov_cnt > 0)
+    {
+      size_t seg_cnt = iov_cnt < SLOT_SEGS ? iov_cnt : SLOT_SEGS;
+      size_t i;
+
+      submit (d, sec_no, iov, seg_cnt, write);
+      for (i = 0; i < seg_cnt; i++)
+        sec_no += iov[i].cnt;
+      iov += seg_cnt;
+      iov_cnt -= seg_cnt;
+    }
+}
+
+/* Offers disk D one request to transfer consecutive sectors
+   starting at SEC_NO between it and the SEG_CNT buffers in IOV,
+   to D if WRITE, and waits for it to complete.  Buffers are in
+   kernel memory, which is physically contiguous, so each is one
+   descriptor. */
+static void
+submit (struct virtio_disk *d, block_sector_t sec_no,
+        const struct block_iovec *iov, size_t seg_cnt, bool write)
+{
+  struct request r;
+  struct vring_desc *desc;
+  enum intr_level old_level;
+  uint16_t head;
+  size_t slot, i;
+
+  ASSERT (seg_cnt > 0 && seg_cnt <= SLOT_SEGS);
+
+  r.header.type = write ? REQ_OUT : REQ_IN;
+  r.header.reserved = 0;
+  r.header.sector = sec_no;
+  r.status = 0xff;
+  sema_init (&r.done, 0);
+
+  sema_down (&d->free_slots);
+  old_level = intr_disable ();
+  for (slot = 0; d->slot_busy & (1u << slot); slot++)
+    continue;
+  ASSERT (slot < d->slot_cnt);
+  d->slot_busy |= 1u << slot;
+  d->slots[slot] = &r;
+
+  head = slot * SLOT_DESCS;
+  desc = &d->desc[head];
+  desc[0].addr = vtop (&r.header);
+  desc[0].len = sizeof r.header;
+  desc[0].flags = DESC_NEXT;
+  for (i = 0; i < seg_cnt; i++)
+    {
+      desc[i + 1].addr = vtop (iov[i].buffer);
+      desc[i + 1].len = iov[i].cnt * BLOCK_SECTOR_SIZE;
+      desc[i + 1].flags = DESC_NEXT | (write ? 0 : DESC_WRITE);
+    }
+  desc[seg_cnt + 1].addr = vtop (&r.status);
+  desc[seg_cnt + 1].len = sizeof r.status;
+  desc[seg_cnt + 1].flags = DESC_WRITE;
+
+  /* The device must see the entry before the new index. */
+  d->avail->ring[d->avail->idx % d->queue_size] = head;
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+  outw (d->reg_base + REG_QUEUE_NOTIFY, 0);
+  intr_set_level (old_level);
+
+  sema_down (&r.done);
+  if (r.status != REQ_OK)
+    PANIC ("%s: %s failed for sector %"PRDSNu" (status %d)",
+           d->name, write ? "write" : "read", sec_no, r.status);
+}
+
+/* Virtio interrupt handler.  Wakes up the submitter of each
+   request that any disk on the interrupting line has finished. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < disk_cnt; i++)
+    {
+      struct virtio_disk *d = &disks[i];
+
+      if (d->irq != f->vec_no)
+        continue;
+
+      /* Reading the ISR acknowledges the interrupt. */
+      inb (d->reg_base + REG_ISR);
+      while (d->last_used != d->used->idx)
+        {
+          uint16_t head = d->used->ring[d->last_used % d->queue_size].id;
+          size_t slot = head / SLOT_DESCS;
+          struct request *r = d->slots[slot];
+
+          ASSERT (r != NULL && head % SLOT_DESCS == 0);
+          d->last_used++;
+          d->slots[slot] = NULL;
+          d->slot_busy &= ~(1u << slot);
+          sema_up (&d->free_slots);
+          sema_up (&r->done);
+        }
+    }
+}
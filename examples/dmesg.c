@@ -0,0 +1,21 @@
+/* dmesg.c
+
+   Prints the kernel log to the console. */
+
+#include <stdio.h>
+#include <syscall.h>
+
+static char buffer[16384];
+
+int
+main (void) 
+{
+  int len = dmesg (buffer, sizeof buffer);
+  if (len < 0)
+    {
+      printf ("dmesg: failed\n");
+      return EXIT_FAILURE;
+    }
+  write (STDOUT_FILENO, buffer, len);
+  return EXIT_SUCCESS;
+}
@@ -2,9 +2,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <syscall.h>
+#include <ttymode.h>
 
-static void read_line (char line[], size_t);
-static bool backspace (char **pos, char line[]);
+static bool read_line (char line[], size_t);
 
 int
 main (void)
@@ -16,7 +16,8 @@ main (void)
 
       /* Read command. */
       printf ("--");
-      read_line (command, sizeof command);
+      if (!read_line (command, sizeof command))
+        break;
       
       /* Execute command. */
       if (!strcmp (command, "exit"))
@@ -45,60 +46,25 @@ main (void)
 }
 
 /* Reads a line of input from the user into LINE, which has room
-   for SIZE bytes.  Handles backspace and Ctrl+U in the ways
-   expected by Unix users.  On return, LINE will always be
-   null-terminated and will not end in a new-line character. */
-static void
-read_line (char line[], size_t size) 
-{
-  char *pos = line;
-  for (;;)
-    {
-      char c;
-      read (STDIN_FILENO, &c, 1);
-
-      switch (c) 
-        {
-        case '\r':
-          *pos = '\0';
-          putchar ('\n');
-          return;
-
-        case '\b':
-          backspace (&pos, line);
-          break;
-
-        case ('U' - 'A') + 1:       /* Ctrl+U. */
-          while (backspace (&pos, line))
-            continue;
-          break;
-
-        default:
-          /* Add character to line. */
-          if (pos < line + size - 1) 
-            {
-              putchar (c);
-              *pos++ = c;
-            }
-          break;
-        }
-    }
-}
-
-/* If *POS is past the beginning of LINE, backs up one character
-   position.  Returns true if successful, false if nothing was
-   done. */
+   for SIZE bytes.  The kernel's terminal handles echo and line
+   editing, and one read() of TTY_LINE_MAX bytes returns the whole
+   line, so a line too long for LINE is cut short without leaving
+   its rest to be read as the next command.  On return, LINE will
+   always be null-terminated and will not end in a new-line
+   character.  Returns false at end of input. */
 static bool
-backspace (char **pos, char line[]) 
+read_line (char line[], size_t size) 
 {
-  if (*pos > line)
-    {
-      /* Back up cursor, overwrite character, back up
-         again. */
-      printf ("\b \b");
-      (*pos)--;
-      return true;
-    }
-  else
+  char buf[TTY_LINE_MAX];
+  int len = read (STDIN_FILENO, buf, sizeof buf);
+  if (len <= 0)
     return false;
+
+  if (buf[len - 1] == '\n')
+    len--;
+  if ((size_t) len > size - 1)
+    len = size - 1;
+  memcpy (line, buf, len);
+  line[len] = '\0';
+  return true;
 }
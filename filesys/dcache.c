@@ -0,0 +1,222 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Maps (directory inode sector, name) to the sector of the named
+   file's inode and the offset of its entry in the directory, so
+   that looking up a name does not read the directory.  A
+   negative entry, with sector DCACHE_NEGATIVE, records that the
+   name is absent, which spares the scan of the whole directory
+   when creating a file or opening a missing one.
+
+   dir_add() and dir_remove() keep the cache in step with the
+   directories through dcache_update().  An entry filled in after
+   a directory scan could race with such an update, so each update
+   bumps a generation number, and dcache_insert() drops entries
+   whose scan began before the latest update.
+
+   At most DCACHE_MAX entries are kept, least recently used ones
+   being dropped first. */
+
+/* Maximum number of cached entries. */
+#define DCACHE_MAX 256
+
+/* A cached name. */
+struct dentry
+  {
+    struct hash_elem hash_elem;         /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in lru. */
+    block_sector_t dir;                 /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name in directory. */
+    block_sector_t sector;              /* Inode sector or negative. */
+    off_t ofs;                          /* Offset of directory entry. */
+  };
+
+static struct hash dentries;            /* All entries. */
+static struct list lru;                 /* Most recently used first. */
+static size_t dentry_cnt;               /* Number of entries. */
+static unsigned generation;             /* Number of updates. */
+static struct lock dcache_lock;         /* Protects all of the above. */
+
+/* Statistics. */
+static long long hit_cnt;               /* Positive hits. */
+static long long negative_hit_cnt;      /* Negative hits. */
+static long long miss_cnt;              /* Misses. */
+
+static struct dentry *find (block_sector_t dir, const char *name);
+static void store (block_sector_t dir, const char *name,
+                   block_sector_t sector, off_t ofs);
+
+/* Returns a hash value for the dentry that contains E. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_int (d->dir);
+}
+
+/* Returns true if dentry A precedes dentry B. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->dir != b->dir)
+    return a->dir < b->dir;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dentries, dentry_hash, dentry_less, NULL);
+  list_init (&lru);
+  dentry_cnt = 0;
+  generation = 0;
+  lock_init (&dcache_lock);
+}
+
+/* Returns the current generation, to be passed to dcache_insert()
+   after scanning a directory. */
+unsigned
+dcache_generation (void)
+{
+  unsigned gen;
+
+  lock_acquire (&dcache_lock);
+  gen = generation;
+  lock_release (&dcache_lock);
+  return gen;
+}
+
+/* Looks up NAME in the directory whose inode is in sector DIR.
+   Returns false if the cache does not know.  Otherwise returns
+   true and stores the sector of NAME's inode into *SECTORP, or
+   DCACHE_NEGATIVE if DIR has no entry for NAME, and the offset
+   of the entry into *OFSP. */
+bool
+dcache_lookup (block_sector_t dir, const char *name,
+               block_sector_t *sectorp, off_t *ofsp)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = find (dir, name);
+  if (d == NULL)
+    {
+      miss_cnt++;
+      lock_release (&dcache_lock);
+      return false;
+    }
+  list_remove (&d->lru_elem);
+  list_push_front (&lru, &d->lru_elem);
+  *sectorp = d->sector;
+  *ofsp = d->ofs;
+  if (d->sector == DCACHE_NEGATIVE)
+    negative_hit_cnt++;
+  else
+    hit_cnt++;
+  lock_release (&dcache_lock);
+  return true;
+}
+
+/* Caches the result of a directory scan that began at generation
+   GEN: NAME in directory DIR names the inode in SECTOR, at
+   offset OFS, or is absent if SECTOR is DCACHE_NEGATIVE.  Ignored
+   if the directories changed since GEN. */
+void
+dcache_insert (block_sector_t dir, const char *name,
+               block_sector_t sector, off_t ofs, unsigned gen)
+{
+  lock_acquire (&dcache_lock);
+  if (gen == generation)
+    store (dir, name, sector, ofs);
+  lock_release (&dcache_lock);
+}
+
+/* Records that NAME in directory DIR now names the inode in
+   SECTOR, at offset OFS, or was removed if SECTOR is
+   DCACHE_NEGATIVE. */
+void
+dcache_update (block_sector_t dir, const char *name,
+               block_sector_t sector, off_t ofs)
+{
+  lock_acquire (&dcache_lock);
+  generation++;
+  store (dir, name, sector, ofs);
+  lock_release (&dcache_lock);
+}
+
+/* Prints directory entry cache statistics. */
+void
+dcache_print_stats (void)
+{
+  printf ("Dcache: %lld hits, %lld negative hits, %lld misses\n",
+          hit_cnt, negative_hit_cnt, miss_cnt);
+}
+
+/* Returns the entry for NAME in DIR, or a null pointer if there
+   is none.  dcache_lock must be held. */
+static struct dentry *
+find (block_sector_t dir, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  key.dir = dir;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dentries, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Sets the entry for NAME in DIR, creating it if necessary and
+   dropping the least recently used entry if there are too many.
+   Does nothing if memory is short.  dcache_lock must be held. */
+static void
+store (block_sector_t dir, const char *name, block_sector_t sector,
+       off_t ofs)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  d = find (dir, name);
+  if (d != NULL)
+    list_remove (&d->lru_elem);
+  else if (dentry_cnt >= DCACHE_MAX)
+    {
+      /* Reuse the least recently used entry. */
+      d = list_entry (list_pop_back (&lru), struct dentry, lru_elem);
+      hash_delete (&dentries, &d->hash_elem);
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+    }
+  else
+    {
+      d = malloc (sizeof *d);
+      if (d == NULL)
+        return;
+      d->dir = dir;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dentries, &d->hash_elem);
+      dentry_cnt++;
+    }
+  d->sector = sector;
+  d->ofs = ofs;
+  list_push_front (&lru, &d->lru_elem);
+}
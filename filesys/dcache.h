@@ -0,0 +1,22 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+#include "filesys/off_t.h"
+
+/* Sector stored for a name known to be absent.  Sector 0 holds
+   the free map inode, which no directory entry names. */
+#define DCACHE_NEGATIVE ((block_sector_t) 0)
+
+void dcache_init (void);
+unsigned dcache_generation (void);
+bool dcache_lookup (block_sector_t dir, const char *name,
+                    block_sector_t *sectorp, off_t *ofsp);
+void dcache_insert (block_sector_t dir, const char *name,
+                    block_sector_t sector, off_t ofs, unsigned generation);
+void dcache_update (block_sector_t dir, const char *name,
+                    block_sector_t sector, off_t ofs);
+void dcache_print_stats (void);
+
+#endif /* filesys/dcache.h */
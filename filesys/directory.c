@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -26,7 +27,7 @@ struct dir_entry
 bool
 dir_create (block_sector_t sector, size_t entry_cnt)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  return inode_create (sector, entry_cnt * sizeof (struct dir_entry), true);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -88,27 +89,50 @@ dir_get_inode (struct dir *dir)
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+   otherwise, returns false and ignores EP and OFSP.
+   Answers from the directory entry cache if it knows NAME, and
+   otherwise caches the outcome of the scan. */
 static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
+  block_sector_t dir_sector, sector;
   struct dir_entry e;
-  size_t ofs;
+  off_t ofs;
+  unsigned gen;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  dir_sector = inode_get_inumber (dir->inode);
+  if (dcache_lookup (dir_sector, name, &sector, &ofs))
+    {
+      if (sector == DCACHE_NEGATIVE)
+        return false;
+      if (ep != NULL)
+        {
+          ep->inode_sector = sector;
+          strlcpy (ep->name, name, sizeof ep->name);
+          ep->in_use = true;
+        }
+      if (ofsp != NULL)
+        *ofsp = ofs;
+      return true;
+    }
+
+  gen = dcache_generation ();
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
       {
+        dcache_insert (dir_sector, name, e.inode_sector, ofs, gen);
         if (ep != NULL)
           *ep = e;
         if (ofsp != NULL)
           *ofsp = ofs;
         return true;
       }
+  dcache_insert (dir_sector, name, DCACHE_NEGATIVE, 0, gen);
   return false;
 }
 
@@ -174,6 +198,8 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    dcache_update (inode_get_inumber (dir->inode), name, inode_sector, ofs);
 
  done:
   return success;
@@ -206,6 +232,7 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  dcache_update (inode_get_inumber (dir->inode), name, DCACHE_NEGATIVE, 0);
 
   /* Remove inode. */
   inode_remove (inode);
@@ -0,0 +1,539 @@
+#include "filesys/free-extent.h"
+#include <bitmap.h>
+#include <debug.h>
+#include <stdint.h>
+#include "threads/malloc.h"
+
+/* Index of the free sectors of the file system device, as runs
+   of consecutive free sectors ("extents").  The free map bitmap
+   stays the authority; this index mirrors it so that allocation
+   need not scan the bitmap.
+
+   Every extent is in two AVL trees: BY_POS, ordered by first
+   sector, for "near this sector" allocation and for coalescing
+   freed sectors with their neighbors, and BY_SIZE, ordered by
+   length and then by first sector, for best-fit allocation.
+   Each node of BY_POS also knows the longest extent below it, so
+   that the closest extent big enough for a request is found
+   without visiting the smaller ones.  Every operation takes time
+   logarithmic in the number of extents.
+
+   If memory runs out while the index is being updated, the index
+   is marked invalid.  The free map then rebuilds it, or falls
+   back to scanning the bitmap. */
+
+/* The trees. */
+enum tree
+  {
+    BY_POS,                             /* By first sector. */
+    BY_SIZE,                            /* By length, then position. */
+    TREE_CNT
+  };
+
+/* Links of an extent in one tree. */
+struct link
+  {
+    struct extent *left, *right;        /* Children. */
+    int height;                         /* Height of subtree, 1 if leaf. */
+    size_t max_length;                  /* Longest extent in subtree. */
+  };
+
+/* A run of free sectors. */
+struct extent
+  {
+    block_sector_t start;               /* First free sector. */
+    size_t length;                      /* Number of free sectors. */
+    struct link links[TREE_CNT];        /* Links in each tree. */
+  };
+
+#define LINK(X, TREE) (&(X)->links[TREE])
+
+static struct extent *roots[TREE_CNT];  /* Root of each tree. */
+static bool index_valid;                /* False if out of sync. */
+
+static void clear_index (void);
+static bool add_extent (block_sector_t start, size_t length);
+static void resize_extent (struct extent *, block_sector_t start,
+                           size_t length);
+static void remove_extent (struct extent *);
+static void take_sectors (struct extent *, block_sector_t start,
+                          size_t cnt);
+static struct extent *tree_insert (struct extent *root, struct extent *,
+                                   enum tree);
+static struct extent *tree_remove (struct extent *root, struct extent *,
+                                   enum tree);
+static struct extent *find_left (struct extent *root, block_sector_t bound,
+                                 size_t cnt);
+static struct extent *find_right (struct extent *root, block_sector_t bound,
+                                  size_t cnt);
+
+/* Returns true if extent A comes before extent B in TREE. */
+static bool
+extent_less (const struct extent *a, const struct extent *b, enum tree tree)
+{
+  if (tree == BY_SIZE && a->length != b->length)
+    return a->length < b->length;
+  return a->start < b->start;
+}
+
+/* Rebuilds the index from MAP, in which set bits mark sectors in
+   use. */
+void
+free_extent_build (const struct bitmap *map) 
+{
+  size_t size = bitmap_size (map);
+  size_t idx = 0;
+
+  clear_index ();
+  index_valid = true;
+  while (idx < size)
+    {
+      size_t start = bitmap_scan (map, idx, 1, false);
+      size_t end;
+
+      if (start == BITMAP_ERROR)
+        break;
+      end = bitmap_scan (map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = size;
+      if (!add_extent (start, end - start))
+        {
+          clear_index ();
+          return;
+        }
+      idx = end;
+    }
+}
+
+/* Returns true if the index matches the free map. */
+bool
+free_extent_valid (void) 
+{
+  return index_valid;
+}
+
+/* Takes CNT consecutive free sectors out of the index and stores
+   the first into *SECTORP.  If NEAR is FREE_EXTENT_ANY, uses the
+   smallest extent that is big enough (best fit).  Otherwise uses
+   the free sectors closest to sector NEAR.  Returns false if no
+   extent is big enough or the index is not valid. */
+bool
+free_extent_allocate (size_t cnt, block_sector_t near,
+                      block_sector_t *sectorp) 
+{
+  struct extent *best = NULL;
+  struct extent *x;
+
+  if (near != FREE_EXTENT_ANY)
+    return free_extent_allocate_range (cnt, near, 0, FREE_EXTENT_ANY,
+                                       sectorp);
+  if (!index_valid || cnt == 0)
+    return false;
+
+  /* Smallest extent of at least CNT sectors. */
+  for (x = roots[BY_SIZE]; x != NULL; )
+    if (x->length >= cnt)
+      {
+        best = x;
+        x = LINK (x, BY_SIZE)->left;
+      }
+    else
+      x = LINK (x, BY_SIZE)->right;
+
+  if (best == NULL)
+    return false;
+  *sectorp = best->start;
+  take_sectors (best, best->start, cnt);
+  return true;
+}
+
+/* Like free_extent_allocate() with a NEAR other than
+   FREE_EXTENT_ANY, but only considers sectors from LO up to, but
+   not including, HI. */
+bool
+free_extent_allocate_range (size_t cnt, block_sector_t near,
+                            block_sector_t lo, block_sector_t hi,
+                            block_sector_t *sectorp) 
+{
+  struct extent *left = NULL, *right = NULL;
+  block_sector_t left_start = 0, right_start = 0;
+  block_sector_t bound;
+  struct extent *x;
+
+  if (!index_valid || cnt == 0 || lo >= hi || hi - lo < cnt)
+    return false;
+  if (near < lo)
+    near = lo;
+  else if (near >= hi)
+    near = hi - 1;
+
+  /* Closest place at or before NEAR.  Only an extent that runs
+     past LO or HI can be too short once cut down to the range,
+     so this takes at most a few lookups. */
+  for (bound = near; (x = find_left (roots[BY_POS], bound, cnt)) != NULL;
+       bound = x->start - 1)
+    {
+      block_sector_t first = x->start > lo ? x->start : lo;
+      block_sector_t end = x->start + x->length;
+
+      if (end <= lo)
+        break;
+      if (end > hi)
+        end = hi;
+      if (end - first >= cnt)
+        {
+          left = x;
+          left_start = near < end - cnt ? near : end - cnt;
+          break;
+        }
+      if (x->start == 0)
+        break;
+    }
+
+  /* Closest place after NEAR. */
+  for (bound = near + 1;
+       (x = find_right (roots[BY_POS], bound, cnt)) != NULL && x->start < hi;
+       bound = x->start + 1)
+    {
+      block_sector_t end = x->start + x->length;
+
+      if (end > hi)
+        end = hi;
+      if (end - x->start >= cnt)
+        {
+          right = x;
+          right_start = x->start;
+          break;
+        }
+    }
+
+  /* Prefer the lower sector if both are as close. */
+  if (right != NULL
+      && (left == NULL || right_start - near < near - left_start))
+    {
+      left = right;
+      left_start = right_start;
+    }
+  if (left == NULL)
+    return false;
+  take_sectors (left, left_start, cnt);
+  *sectorp = left_start;
+  return true;
+}
+
+/* Puts the CNT sectors starting at SECTOR back into the index,
+   merging them with adjacent extents. */
+void
+free_extent_release (block_sector_t sector, size_t cnt) 
+{
+  struct extent *prev, *next;
+
+  if (!index_valid || cnt == 0)
+    return;
+
+  prev = find_left (roots[BY_POS], sector, 1);
+  next = find_right (roots[BY_POS], sector, 1);
+  if (prev != NULL && prev->start + prev->length != sector)
+    prev = NULL;
+  if (next != NULL && sector + cnt != next->start)
+    next = NULL;
+
+  if (prev != NULL && next != NULL)
+    {
+      size_t length = prev->length + cnt + next->length;
+      remove_extent (next);
+      resize_extent (prev, prev->start, length);
+    }
+  else if (prev != NULL)
+    resize_extent (prev, prev->start, prev->length + cnt);
+  else if (next != NULL)
+    resize_extent (next, sector, next->length + cnt);
+  else if (!add_extent (sector, cnt))
+    clear_index ();
+}
+
+/* Frees extent X and every extent below it in BY_POS. */
+static void
+free_subtree (struct extent *x) 
+{
+  if (x != NULL)
+    {
+      free_subtree (LINK (x, BY_POS)->left);
+      free_subtree (LINK (x, BY_POS)->right);
+      free (x);
+    }
+}
+
+/* Frees every extent and marks the index invalid. */
+static void
+clear_index (void) 
+{
+  free_subtree (roots[BY_POS]);
+  roots[BY_POS] = roots[BY_SIZE] = NULL;
+  index_valid = false;
+}
+
+/* Adds an extent of LENGTH sectors starting at START, which must
+   not touch any other extent.  Returns false if out of memory. */
+static bool
+add_extent (block_sector_t start, size_t length) 
+{
+  struct extent *x = malloc (sizeof *x);
+  enum tree tree;
+
+  if (x == NULL)
+    return false;
+  x->start = start;
+  x->length = length;
+  for (tree = 0; tree < TREE_CNT; tree++)
+    roots[tree] = tree_insert (roots[tree], x, tree);
+  return true;
+}
+
+/* Makes extent X cover LENGTH sectors starting at START. */
+static void
+resize_extent (struct extent *x, block_sector_t start, size_t length) 
+{
+  enum tree tree;
+
+  for (tree = 0; tree < TREE_CNT; tree++)
+    roots[tree] = tree_remove (roots[tree], x, tree);
+  x->start = start;
+  x->length = length;
+  for (tree = 0; tree < TREE_CNT; tree++)
+    roots[tree] = tree_insert (roots[tree], x, tree);
+}
+
+/* Removes extent X from the index and frees it. */
+static void
+remove_extent (struct extent *x) 
+{
+  enum tree tree;
+
+  for (tree = 0; tree < TREE_CNT; tree++)
+    roots[tree] = tree_remove (roots[tree], x, tree);
+  free (x);
+}
+
+/* Removes the CNT sectors starting at START, which must lie
+   within X, from X, splitting X in two if needed. */
+static void
+take_sectors (struct extent *x, block_sector_t start, size_t cnt) 
+{
+  block_sector_t end = x->start + x->length;
+  size_t before = start - x->start;
+  size_t after = end - (start + cnt);
+
+  ASSERT (start >= x->start && start + cnt <= end);
+
+  if (before == 0 && after == 0)
+    remove_extent (x);
+  else if (before == 0)
+    resize_extent (x, start + cnt, after);
+  else
+    {
+      resize_extent (x, x->start, before);
+      if (after > 0 && !add_extent (start + cnt, after))
+        clear_index ();
+    }
+}
+
+/* Height of the subtree rooted at X in TREE. */
+static int
+height (const struct extent *x, enum tree tree)
+{
+  return x != NULL ? LINK (x, tree)->height : 0;
+}
+
+/* Longest extent in the subtree rooted at X in TREE. */
+static size_t
+max_length (const struct extent *x, enum tree tree)
+{
+  return x != NULL ? LINK (x, tree)->max_length : 0;
+}
+
+/* Recomputes the height and longest extent of X's subtree in
+   TREE from its children's. */
+static void
+update (struct extent *x, enum tree tree)
+{
+  struct link *l = LINK (x, tree);
+  int left_height = height (l->left, tree);
+  int right_height = height (l->right, tree);
+
+  l->height = (left_height > right_height ? left_height : right_height) + 1;
+  l->max_length = x->length;
+  if (max_length (l->left, tree) > l->max_length)
+    l->max_length = max_length (l->left, tree);
+  if (max_length (l->right, tree) > l->max_length)
+    l->max_length = max_length (l->right, tree);
+}
+
+/* Rotates the subtree rooted at X in TREE to the right and
+   returns its new root. */
+static struct extent *
+rotate_right (struct extent *x, enum tree tree)
+{
+  struct extent *y = LINK (x, tree)->left;
+
+  LINK (x, tree)->left = LINK (y, tree)->right;
+  LINK (y, tree)->right = x;
+  update (x, tree);
+  update (y, tree);
+  return y;
+}
+
+/* Rotates the subtree rooted at X in TREE to the left and
+   returns its new root. */
+static struct extent *
+rotate_left (struct extent *x, enum tree tree)
+{
+  struct extent *y = LINK (x, tree)->right;
+
+  LINK (x, tree)->right = LINK (y, tree)->left;
+  LINK (y, tree)->left = x;
+  update (x, tree);
+  update (y, tree);
+  return y;
+}
+
+/* Restores the AVL balance of the subtree rooted at X in TREE,
+   whose children are balanced and differ in height by at most 2,
+   and returns its new root. */
+static struct extent *
+rebalance (struct extent *x, enum tree tree)
+{
+  struct link *l = LINK (x, tree);
+  int balance;
+
+  update (x, tree);
+  balance = height (l->left, tree) - height (l->right, tree);
+  if (balance > 1)
+    {
+      struct link *c = LINK (l->left, tree);
+      if (height (c->left, tree) < height (c->right, tree))
+        l->left = rotate_left (l->left, tree);
+      return rotate_right (x, tree);
+    }
+  else if (balance < -1)
+    {
+      struct link *c = LINK (l->right, tree);
+      if (height (c->right, tree) < height (c->left, tree))
+        l->right = rotate_right (l->right, tree);
+      return rotate_left (x, tree);
+    }
+  return x;
+}
+
+/* Inserts X into the subtree rooted at ROOT in TREE and returns
+   its new root. */
+static struct extent *
+tree_insert (struct extent *root, struct extent *x, enum tree tree)
+{
+  struct link *l;
+
+  if (root == NULL)
+    {
+      LINK (x, tree)->left = LINK (x, tree)->right = NULL;
+      update (x, tree);
+      return x;
+    }
+
+  l = LINK (root, tree);
+  if (extent_less (x, root, tree))
+    l->left = tree_insert (l->left, x, tree);
+  else
+    l->right = tree_insert (l->right, x, tree);
+  return rebalance (root, tree);
+}
+
+/* Removes the first extent of the subtree rooted at ROOT in TREE,
+   stores it into *MINP, and returns the new root. */
+static struct extent *
+remove_min (struct extent *root, struct extent **minp, enum tree tree)
+{
+  struct link *l = LINK (root, tree);
+
+  if (l->left == NULL)
+    {
+      *minp = root;
+      return l->right;
+    }
+  l->left = remove_min (l->left, minp, tree);
+  return rebalance (root, tree);
+}
+
+/* Removes X, which must be in it, from the subtree rooted at ROOT
+   in TREE and returns the new root. */
+static struct extent *
+tree_remove (struct extent *root, struct extent *x, enum tree tree)
+{
+  struct link *l;
+
+  ASSERT (root != NULL);
+  l = LINK (root, tree);
+  if (root == x)
+    {
+      struct extent *min, *right;
+
+      if (l->left == NULL)
+        return l->right;
+      if (l->right == NULL)
+        return l->left;
+      right = remove_min (l->right, &min, tree);
+      LINK (min, tree)->left = l->left;
+      LINK (min, tree)->right = right;
+      return rebalance (min, tree);
+    }
+
+  if (extent_less (x, root, tree))
+    l->left = tree_remove (l->left, x, tree);
+  else
+    l->right = tree_remove (l->right, x, tree);
+  return rebalance (root, tree);
+}
+
+/* Returns the extent with the highest first sector no greater
+   than BOUND among the extents of at least CNT sectors in the
+   BY_POS subtree rooted at ROOT, or a null pointer if there is
+   none. */
+static struct extent *
+find_left (struct extent *root, block_sector_t bound, size_t cnt)
+{
+  struct link *l;
+  struct extent *x;
+
+  if (max_length (root, BY_POS) < cnt)
+    return NULL;
+  l = LINK (root, BY_POS);
+  if (root->start > bound)
+    return find_left (l->left, bound, cnt);
+  x = find_left (l->right, bound, cnt);
+  if (x != NULL)
+    return x;
+  if (root->length >= cnt)
+    return root;
+  return find_left (l->left, bound, cnt);
+}
+
+/* Returns the extent with the lowest first sector no less than
+   BOUND among the extents of at least CNT sectors in the BY_POS
+   subtree rooted at ROOT, or a null pointer if there is none. */
+static struct extent *
+find_right (struct extent *root, block_sector_t bound, size_t cnt)
+{
+  struct link *l;
+  struct extent *x;
+
+  if (max_length (root, BY_POS) < cnt)
+    return NULL;
+  l = LINK (root, BY_POS);
+  if (root->start < bound)
+    return find_right (l->right, bound, cnt);
+  x = find_right (l->left, bound, cnt);
+  if (x != NULL)
+    return x;
+  if (root->length >= cnt)
+    return root;
+  return find_right (l->right, bound, cnt);
+}
@@ -0,0 +1,22 @@
+#ifndef FILESYS_FREE_EXTENT_H
+#define FILESYS_FREE_EXTENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* No locality preference for free_extent_allocate(). */
+#define FREE_EXTENT_ANY ((block_sector_t) -1)
+
+struct bitmap;
+
+void free_extent_build (const struct bitmap *);
+bool free_extent_valid (void);
+bool free_extent_allocate (size_t cnt, block_sector_t near,
+                           block_sector_t *sectorp);
+bool free_extent_allocate_range (size_t cnt, block_sector_t near,
+                                 block_sector_t lo, block_sector_t hi,
+                                 block_sector_t *sectorp);
+void free_extent_release (block_sector_t, size_t cnt);
+
+#endif /* filesys/free-extent.h */
@@ -1,52 +1,198 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/free-extent.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Sectors of the free map file that differ from the disk, one bit
+   per sector.  Changes to the free map only mark them; they reach
+   the disk at the next free_map_sync(). */
+static struct bitmap *dirty_map;
+
+/* Protects the free map, the dirty map and the free extent index.
+   Allocation runs under only the lock of the file being grown, so
+   writers to different files reach here at the same time.  Callers
+   may hold inode locks when they take it; while it is held, only
+   the free map file's own inode is written, which is fully
+   allocated and so never allocates. */
+static struct lock free_map_lock;
+
+/* Number of device sectors described by one free map file sector. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Sectors per block group.  As in FFS and ext2, the disk is cut
+   into groups, and a file's inode and data go to its directory's
+   group. */
+#define GROUP_SECTORS 1024
+
+static bool allocate (size_t cnt, block_sector_t near, block_sector_t lo,
+                      block_sector_t hi, block_sector_t *);
+static void mark_dirty (block_sector_t, size_t);
+
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  lock_init (&free_map_lock);
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  dirty_map = bitmap_create (DIV_ROUND_UP (block_size (fs_device),
+                                           BITS_PER_SECTOR));
+  if (dirty_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  bitmap_mark (free_map, JOURNAL_SECTOR);
+  free_extent_build (free_map);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP, using the smallest run of free
+   sectors that is big enough.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.  The change reaches the disk at the
+   next free_map_sync(). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = allocate (cnt, FREE_EXTENT_ANY, 0, FREE_EXTENT_ANY, sectorp);
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Like free_map_allocate(), but places the CNT sectors in the
+   block group of sector NEAR, as close to NEAR as possible, or
+   if that group is full, as close to NEAR as possible anywhere.
+   Use this to keep a file's inode and data in its directory's
+   group. */
+bool
+free_map_allocate_near (size_t cnt, block_sector_t near,
+                        block_sector_t *sectorp)
+{
+  block_sector_t lo = near - near % GROUP_SECTORS;
+  bool success;
+
+  lock_acquire (&free_map_lock);
+  success = (allocate (cnt, near, lo, lo + GROUP_SECTORS, sectorp)
+             || allocate (cnt, near, 0, FREE_EXTENT_ANY, sectorp));
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Allocates CNT consecutive sectors between LO and HI, closest to
+   NEAR or best fit if NEAR is FREE_EXTENT_ANY, and stores the
+   first into *SECTORP.  Returns true if successful.  The caller
+   must hold free_map_lock. */
+static bool
+allocate (size_t cnt, block_sector_t near, block_sector_t lo,
+          block_sector_t hi, block_sector_t *sectorp)
+{
+  block_sector_t sector;
+
+  if (cnt == 0)
+    {
+      *sectorp = 0;
+      return true;
+    }
+
+  if (!free_extent_valid ())
+    free_extent_build (free_map);
+  if (free_extent_valid ())
+    {
+      if (near == FREE_EXTENT_ANY
+          ? !free_extent_allocate (cnt, near, &sector)
+          : !free_extent_allocate_range (cnt, near, lo, hi, &sector))
+        return false;
+      ASSERT (bitmap_none (free_map, sector, cnt));
+      bitmap_set_multiple (free_map, sector, cnt, true);
+    }
+  else
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      /* Out of memory for the index: scan the bitmap. */
+      size_t size = bitmap_size (free_map);
+      if (hi > size)
+        hi = size;
+      if (lo >= hi || hi - lo < cnt)
+        return false;
+      sector = bitmap_scan (free_map, lo, cnt, false);
+      if (sector == BITMAP_ERROR || sector + cnt > hi)
+        return false;
+      bitmap_set_multiple (free_map, sector, cnt, true);
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+
+  mark_dirty (sector, cnt);
+  *sectorp = sector;
+  return true;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Makes CNT sectors starting at SECTOR available for use.  The
+   change reaches the disk at the next free_map_sync().  The
+   journal stops replaying old copies of the sectors, since they
+   may be reused for file data. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_extent_release (sector, cnt);
+  mark_dirty (sector, cnt);
+  journal_revoke (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the sectors of the free map file that changed since the
+   last sync.  Returns true if successful, false if a write
+   failed, in which case the failed sectors stay dirty. */
+bool
+free_map_sync (void) 
+{
+  size_t idx = 0;
+  bool success = true;
+
+  if (free_map_file == NULL)
+    return true;
+
+  /* The write goes through the journal, whose handle is taken
+     before any lock, as in inode writes. */
+  journal_begin ();
+  lock_acquire (&free_map_lock);
+  while ((idx = bitmap_scan (dirty_map, idx, 1, true)) != BITMAP_ERROR)
+    {
+      if (bitmap_write_part (free_map, free_map_file,
+                             idx * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+        bitmap_reset (dirty_map, idx);
+      else
+        success = false;
+      idx++;
+    }
+  lock_release (&free_map_lock);
+  journal_end ();
+  return success;
+}
+
+/* Notes that the free map bits for the CNT sectors starting at
+   SECTOR changed.  The caller must hold free_map_lock. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt) 
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  if (cnt > 0)
+    bitmap_set_multiple (dirty_map, first, last - first + 1, true);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -58,12 +204,14 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  free_extent_build (free_map);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_sync ();
   file_close (free_map_file);
 }
 
@@ -73,7 +221,7 @@ void
 free_map_create (void) 
 {
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), true))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
@@ -82,4 +230,8 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+
+  /* Writing the file allocated its sectors, changing the free map
+     behind the written copy.  Those changes stay dirty for the
+     next sync. */
 }
@@ -1,79 +1,545 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
-#include <debug.h>
 #include <round.h>
+#include <debug.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#ifdef VM
+#include "vm/pagecache.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of closed inodes kept in memory for quick reopening. */
+#define INODE_LRU_MAX 64
+
+/* Data sectors listed in the inode itself. */
+#define DIRECT_CNT 123
+
+/* Sector numbers that fit in one index sector. */
+#define PTRS_PER_SECTOR (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+
+/* Bytes of data that fit in the inode itself, in place of the
+   index. */
+#define INLINE_SIZE ((DIRECT_CNT + 2) * sizeof (block_sector_t))
+
+/* Inode flags. */
+#define INODE_JOURNALED 0x1             /* Data is metadata. */
+#define INODE_INLINE 0x2                /* Data is in inline_data. */
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   Data sectors are found through a Unix-style index: the first
+   DIRECT_CNT are listed in the inode, the next PTRS_PER_SECTOR in
+   an indirect sector, and the rest in the indirect sectors listed
+   by a doubly indirect sector.  Sector number 0 (the free map
+   inode, never a data sector) marks a hole, which reads back as
+   zeros and gets a sector when first written.
+
+   A file of at most INLINE_SIZE bytes keeps its data in the inode
+   instead of the index, so that it takes one sector and one read.
+   It moves out to data sectors when it grows any larger. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t flags;                     /* INODE_* flags. */
+    union
+      {
+        struct
+          {
+            block_sector_t direct[DIRECT_CNT];  /* Direct data sectors. */
+            block_sector_t indirect;            /* Indirect sector. */
+            block_sector_t doubly_indirect;     /* Doubly indirect. */
+          };
+        uint8_t inline_data[INLINE_SIZE];       /* Inline data. */
+      };
   };
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem hash_elem;         /* Element in inode table. */
+    struct list_elem lru_elem;          /* Element in LRU list, if closed. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    bool loading;                       /* Data still being read in? */
+    struct condition loaded;            /* Signaled when it has been. */
+    struct rwlock rw;                   /* Guards data and the index. */
+    struct lock extend_lock;            /* Serializes growing writes. */
     struct inode_disk data;             /* Inode content. */
   };
 
-/* Returns the number of sectors to allocate for an inode SIZE
-   bytes long. */
-static inline size_t
-bytes_to_sectors (off_t size)
-{
-  return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
-}
-
+static bool walk_index (block_sector_t *, int level, size_t idx, bool create,
+                        block_sector_t near, bool *changed, bool *fresh,
+                        block_sector_t *sectorp);
+static void release_index (block_sector_t, int level);
+static void index_read (block_sector_t, block_sector_t *);
+static bool index_get (block_sector_t, size_t slot, block_sector_t *);
+static void index_write (block_sector_t, const block_sector_t *);
+static void index_forget (block_sector_t);
+static bool move_out (struct inode *);
+static void read_sector (const struct inode *, block_sector_t, void *);
+static void write_sector (const struct inode *, block_sector_t, const void *);
+static size_t sector_run (struct inode *, off_t, block_sector_t, size_t max,
+                          bool create, bool lock, bool *allocated);
+static off_t read_locked (struct inode *, void *, off_t size, off_t offset);
+static off_t write_locked (struct inode *, const void *, off_t size,
+                           off_t offset);
 
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   within INODE, or 0 if that byte lies in a hole.
+   If CREATE is true, allocates the sector, and any index sectors
+   on the way to it, if missing, and sets *FRESH to true if the
+   data sector is new and so holds garbage.
+   Returns -1 if POS is beyond the largest file size, or if memory
+   or disk allocation fails. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos, bool create, bool *fresh) 
 {
+  struct inode_disk *data = &inode->data;
+  size_t idx = pos / BLOCK_SECTOR_SIZE;
+  block_sector_t *rootp, sector;
+  bool changed = false;
+  int level;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
+  ASSERT (pos >= 0);
+
+  if (idx < DIRECT_CNT)
+    {
+      rootp = &data->direct[idx];
+      level = 0;
+    }
+  else if ((idx -= DIRECT_CNT) < PTRS_PER_SECTOR)
+    {
+      rootp = &data->indirect;
+      level = 1;
+    }
+  else if ((idx -= PTRS_PER_SECTOR) < PTRS_PER_SECTOR * PTRS_PER_SECTOR)
+    {
+      rootp = &data->doubly_indirect;
+      level = 2;
+    }
   else
     return -1;
+
+  /* Place data near the inode. */
+  if (fresh != NULL)
+    *fresh = false;
+  if (!walk_index (rootp, level, idx, create, inode->sector,
+                   &changed, fresh, &sector))
+    return -1;
+  if (changed)
+    journal_write (inode->sector, data);
+  return sector;
+}
+
+/* Finds entry IDX in the tree of LEVEL levels of index sectors
+   whose root is *ROOTP, where level 0 means that *ROOTP is the
+   data sector itself, and stores the data sector, or 0 for a
+   hole, into *SECTORP.  If CREATE is true, missing sectors are
+   allocated near NEAR, *CHANGED is set to true if *ROOTP changed,
+   and *FRESH, if non-null, is set to true if the data sector was
+   allocated.  Returns false if memory or disk allocation fails. */
+static bool
+walk_index (block_sector_t *rootp, int level, size_t idx, bool create,
+            block_sector_t near, bool *changed, bool *fresh,
+            block_sector_t *sectorp)
+{
+  static block_sector_t holes[PTRS_PER_SECTOR];
+  size_t span = level > 1 ? PTRS_PER_SECTOR : 1;
+  block_sector_t *index;
+  bool index_changed = false;
+  bool ok;
+
+  if (*rootp == 0)
+    {
+      if (!create)
+        {
+          *sectorp = 0;
+          return true;
+        }
+      if (!free_map_allocate_near (1, near, rootp))
+        return false;
+      *changed = true;
+      if (level > 0)
+        index_write (*rootp, holes);
+      else if (fresh != NULL)
+        *fresh = true;
+    }
+  if (level == 0)
+    {
+      *sectorp = *rootp;
+      return true;
+    }
+
+  /* A lookup only needs one entry of the index sector. */
+  if (!create)
+    {
+      block_sector_t next;
+
+      return (index_get (*rootp, idx / span, &next)
+              && walk_index (&next, level - 1, idx % span, false,
+                             *rootp, &index_changed, fresh, sectorp));
+    }
+
+  index = malloc (BLOCK_SECTOR_SIZE);
+  if (index == NULL)
+    return false;
+  index_read (*rootp, index);
+  ok = walk_index (&index[idx / span], level - 1, idx % span, create,
+                   *rootp, &index_changed, fresh, sectorp);
+  if (index_changed)
+    index_write (*rootp, index);
+  free (index);
+  return ok;
+}
+
+/* Moves the inline data of INODE out to a data sector, so that
+   the file can grow past INLINE_SIZE.  Returns false if memory
+   or disk allocation fails. */
+static bool
+move_out (struct inode *inode)
+{
+  uint8_t *copy = NULL;
+  block_sector_t sector;
+
+  if (inode->data.length > 0)
+    {
+      copy = calloc (1, BLOCK_SECTOR_SIZE);
+      if (copy == NULL)
+        return false;
+      memcpy (copy, inode->data.inline_data, INLINE_SIZE);
+    }
+
+  /* Turn the inline data into an empty index. */
+  memset (inode->data.inline_data, 0, INLINE_SIZE);
+  inode->data.flags &= ~INODE_INLINE;
+
+  if (copy != NULL)
+    {
+      sector = byte_to_sector (inode, 0, true, NULL);
+      if (sector == (block_sector_t) -1)
+        {
+          memcpy (inode->data.inline_data, copy, INLINE_SIZE);
+          inode->data.flags |= INODE_INLINE;
+          free (copy);
+          return false;
+        }
+      write_sector (inode, sector, copy);
+      free (copy);
+    }
+  journal_write (inode->sector, &inode->data);
+  return true;
+}
+
+/* Frees SECTOR and, if it is an index sector with LEVEL levels
+   below it, the sectors it lists. */
+static void
+release_index (block_sector_t sector, int level)
+{
+  if (sector == 0)
+    return;
+  if (level > 0)
+    {
+      block_sector_t *index = malloc (BLOCK_SECTOR_SIZE);
+      size_t i;
+
+      if (index != NULL)
+        {
+          index_read (sector, index);
+          for (i = 0; i < PTRS_PER_SECTOR; i++)
+            release_index (index[i], level - 1);
+          free (index);
+        }
+      index_forget (sector);
+    }
+  free_map_release (sector, 1);
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Index sectors read recently, most recently used first, so that
+   looking up one data sector after another does not read the
+   same indirect sectors again each time.  Index sectors only
+   change through index_write() and are only freed by
+   release_index(), which keep the cache current.  INDEX_GEN
+   counts changes, so that a sector read from disk is cached only
+   if nothing changed while the read was in progress. */
+#define INDEX_CACHE_CNT 16
+
+struct index_block
+  {
+    struct list_elem elem;              /* Element in index_lru. */
+    block_sector_t sector;              /* Index sector, 0 if unused. */
+    block_sector_t ptrs[PTRS_PER_SECTOR];       /* Its contents. */
+  };
+
+static struct index_block index_blocks[INDEX_CACHE_CNT];
+static struct list index_lru;
+static unsigned index_gen;
+
+/* Protects index_blocks, index_lru, and index_gen.  Never held
+   across disk I/O. */
+static struct lock index_lock;
+
+/* Initializes the index sector cache. */
+static void
+index_init (void) 
+{
+  size_t i;
+
+  list_init (&index_lru);
+  for (i = 0; i < INDEX_CACHE_CNT; i++)
+    list_push_back (&index_lru, &index_blocks[i].elem);
+  lock_init (&index_lock);
+}
+
+/* Returns the cached copy of index sector SECTOR, making it the
+   most recently used, or a null pointer if it is not cached.
+   index_lock must be held. */
+static struct index_block *
+index_find (block_sector_t sector) 
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&index_lru); e != list_end (&index_lru);
+       e = list_next (e))
+    {
+      struct index_block *b = list_entry (e, struct index_block, elem);
+      if (b->sector == sector)
+        {
+          list_remove (&b->elem);
+          list_push_front (&index_lru, &b->elem);
+          return b;
+        }
+    }
+  return NULL;
+}
+
+/* Caches PTRS as the contents of index sector SECTOR, replacing
+   the least recently used entry if SECTOR is not cached yet.
+   index_lock must be held. */
+static void
+index_fill (block_sector_t sector, const block_sector_t *ptrs) 
+{
+  struct index_block *b = index_find (sector);
+
+  if (b == NULL)
+    {
+      b = list_entry (list_back (&index_lru), struct index_block, elem);
+      list_remove (&b->elem);
+      list_push_front (&index_lru, &b->elem);
+      b->sector = sector;
+    }
+  memcpy (b->ptrs, ptrs, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads index sector SECTOR into PTRS. */
+static void
+index_read (block_sector_t sector, block_sector_t *ptrs) 
+{
+  struct index_block *b;
+  unsigned gen;
+
+  lock_acquire (&index_lock);
+  b = index_find (sector);
+  if (b != NULL)
+    {
+      memcpy (ptrs, b->ptrs, BLOCK_SECTOR_SIZE);
+      lock_release (&index_lock);
+      return;
+    }
+  gen = index_gen;
+  lock_release (&index_lock);
+
+  journal_read (sector, ptrs);
+
+  lock_acquire (&index_lock);
+  if (index_gen == gen)
+    index_fill (sector, ptrs);
+  lock_release (&index_lock);
+}
+
+/* Stores entry SLOT of index sector SECTOR into *VALUEP.
+   Returns false if memory runs out. */
+static bool
+index_get (block_sector_t sector, size_t slot, block_sector_t *valuep) 
+{
+  struct index_block *b;
+  block_sector_t *ptrs;
+
+  lock_acquire (&index_lock);
+  b = index_find (sector);
+  if (b != NULL)
+    *valuep = b->ptrs[slot];
+  lock_release (&index_lock);
+  if (b != NULL)
+    return true;
+
+  ptrs = malloc (BLOCK_SECTOR_SIZE);
+  if (ptrs == NULL)
+    return false;
+  index_read (sector, ptrs);
+  *valuep = ptrs[slot];
+  free (ptrs);
+  return true;
+}
+
+/* Writes PTRS to index sector SECTOR through the journal. */
+static void
+index_write (block_sector_t sector, const block_sector_t *ptrs) 
+{
+  journal_write (sector, ptrs);
+  lock_acquire (&index_lock);
+  index_fill (sector, ptrs);
+  index_gen++;
+  lock_release (&index_lock);
+}
+
+/* Drops index sector SECTOR, which is being freed, from the
+   cache. */
+static void
+index_forget (block_sector_t sector) 
+{
+  struct index_block *b;
+
+  lock_acquire (&index_lock);
+  b = index_find (sector);
+  if (b != NULL)
+    b->sector = 0;
+  index_gen++;
+  lock_release (&index_lock);
+}
+
+/* In-memory inodes, keyed by sector, so that opening a single
+   inode twice returns the same `struct inode'.  Besides the open
+   inodes, the table holds up to INODE_LRU_MAX recently closed
+   ones, which wait in inode_lru, least recently closed last, and
+   can be reopened without reading their sector again. */
+static struct hash inode_table;
+static struct list inode_lru;
+static size_t inode_lru_cnt;
+
+/* Protects inode_table, inode_lru, and open_cnt and loading of
+   every inode.  It is not held across disk reads: an inode being
+   read in is in the table with LOADING set, and other openers wait
+   on it. */
+static struct lock inode_table_lock;
+
+static unsigned inode_hash (const struct hash_elem *, void *);
+static bool inode_less (const struct hash_elem *, const struct hash_elem *,
+                        void *);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  hash_init (&inode_table, inode_hash, inode_less, NULL);
+  list_init (&inode_lru);
+  inode_lru_cnt = 0;
+  lock_init (&inode_table_lock);
+  index_init ();
+}
+
+/* Returns a hash value for the inode that contains E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, hash_elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if the inode that contains A has a lower sector
+   than the one that contains B. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, hash_elem)->sector
+          < hash_entry (b, struct inode, hash_elem)->sector);
+}
+
+/* Reads data sector SECTOR of INODE into BUFFER, through the
+   journal if INODE holds metadata, since only metadata can have
+   a newer copy there. */
+static void
+read_sector (const struct inode *inode, block_sector_t sector,
+             void *buffer)
+{
+  if (inode->data.flags & INODE_JOURNALED)
+    journal_read (sector, buffer);
+  else
+    block_read (fs_device, sector, buffer);
+}
+
+/* Writes BUFFER to data sector SECTOR of INODE, through the
+   journal if INODE holds metadata. */
+static void
+write_sector (const struct inode *inode, block_sector_t sector,
+              const void *buffer)
+{
+  if (inode->data.flags & INODE_JOURNALED)
+    journal_write (sector, buffer);
+  else
+    block_write (fs_device, sector, buffer);
+}
+
+/* Returns the number of sectors of INODE's data, at most MAX and
+   at least 1, from byte offset OFFSET on that lie one after
+   another on disk starting at SECTOR, which holds OFFSET, so that
+   they can move in one request.  If CREATE is true, allocates
+   sectors in holes on the way, setting *ALLOCATED if it does,
+   taking INODE's write lock around each lookup if LOCK is
+   true. */
+static size_t
+sector_run (struct inode *inode, off_t offset, block_sector_t sector,
+            size_t max, bool create, bool lock, bool *allocated)
+{
+  size_t cnt;
+
+  for (cnt = 1; cnt < max; cnt++)
+    {
+      block_sector_t next;
+      bool fresh = false;
+
+      if (lock)
+        rwlock_acquire_write (&inode->rw);
+      next = byte_to_sector (inode, offset + cnt * BLOCK_SECTOR_SIZE,
+                             create, &fresh);
+      if (lock)
+        rwlock_release_write (&inode->rw);
+      if (fresh)
+        *allocated = true;
+      if (next != sector + cnt)
+        break;
+    }
+  return cnt;
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  If JOURNALED is true, the data is metadata, such as
+   a directory, and is written through the journal like the
+   inode itself.
+   The data starts out as one big hole, so no data sectors are
+   allocated or written until the file is written to.  A file no
+   bigger than INLINE_SIZE starts out inline.
    Returns true if successful.
-   Returns false if memory or disk allocation fails. */
+   Returns false if memory allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool journaled)
 {
   struct inode_disk *disk_inode = NULL;
-  bool success = false;
 
   ASSERT (length >= 0);
 
@@ -82,27 +548,18 @@ inode_create (block_sector_t sector, off_t length)
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
   disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
-    {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
-      free (disk_inode);
-    }
-  return success;
+  if (disk_inode == NULL)
+    return false;
+
+  disk_inode->length = length;
+  disk_inode->magic = INODE_MAGIC;
+  if (journaled)
+    disk_inode->flags |= INODE_JOURNALED;
+  if (length <= (off_t) INLINE_SIZE)
+    disk_inode->flags |= INODE_INLINE;
+  journal_write (sector, disk_inode);
+  free (disk_inode);
+  return true;
 }
 
 /* Reads an inode from SECTOR
@@ -111,33 +568,56 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /* Check whether this inode is already in memory. */
+  key.sector = sector;
+  lock_acquire (&inode_table_lock);
+  e = hash_find (&inode_table, &key.hash_elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      inode = hash_entry (e, struct inode, hash_elem);
+      if (inode->open_cnt++ == 0)
         {
-          inode_reopen (inode);
-          return inode; 
+          list_remove (&inode->lru_elem);
+          inode_lru_cnt--;
         }
+      while (inode->loading)
+        cond_wait (&inode->loaded, &inode_table_lock);
+      lock_release (&inode_table_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&inode_table_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
+  rwlock_init (&inode->rw);
+  lock_init (&inode->extend_lock);
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->loading = true;
+  cond_init (&inode->loaded);
+  hash_insert (&inode_table, &inode->hash_elem);
+  lock_release (&inode_table_lock);
+
+  /* Read it in without holding up opens and closes of other
+     inodes. */
+  journal_read (inode->sector, &inode->data);
+
+  lock_acquire (&inode_table_lock);
+  inode->loading = false;
+  cond_broadcast (&inode->loaded, &inode_table_lock);
+  lock_release (&inode_table_lock);
   return inode;
 }
 
@@ -146,7 +626,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inode_table_lock);
+      inode->open_cnt++;
+      lock_release (&inode_table_lock);
+    }
   return inode;
 }
 
@@ -158,8 +642,11 @@ inode_get_inumber (const struct inode *inode)
 }
 
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, keeps it in memory
+   among the recently closed inodes, freeing the least recently
+   closed one if there are too many.
+   If INODE was also a removed inode, frees its memory and its
+   blocks right away. */
 void
 inode_close (struct inode *inode) 
 {
@@ -168,21 +655,55 @@ inode_close (struct inode *inode)
     return;
 
   /* Release resources if this was the last opener. */
+  lock_acquire (&inode_table_lock);
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      if (!inode->removed)
+        {
+          /* Keep it around for the next opener, making room by
+             dropping the least recently closed inode. */
+          list_push_front (&inode_lru, &inode->lru_elem);
+          if (++inode_lru_cnt <= INODE_LRU_MAX)
+            {
+              lock_release (&inode_table_lock);
+              return;
+            }
+          inode = list_entry (list_pop_back (&inode_lru),
+                              struct inode, lru_elem);
+          inode_lru_cnt--;
+        }
+
+      /* Remove from inode table and release lock. */
+      hash_delete (&inode_table, &inode->hash_elem);
+      lock_release (&inode_table_lock);
  
+#ifdef VM
+      /* Cached pages must not outlive the inode. */
+      pagecache_drop (inode, !inode->removed);
+#endif
+
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
+          size_t i;
+
+          journal_begin ();
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          if (!(inode->data.flags & INODE_INLINE))
+            {
+              for (i = 0; i < DIRECT_CNT; i++)
+                release_index (inode->data.direct[i], 0);
+              release_index (inode->data.indirect, 1);
+              release_index (inode->data.doubly_indirect, 2);
+            }
+          free_map_sync ();
+          journal_end ();
         }
 
       free (inode); 
     }
+  else
+    lock_release (&inode_table_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -196,18 +717,97 @@ inode_remove (struct inode *inode)
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   With VM, the data of regular files goes through the page cache,
+   which mmap shares. */
+off_t
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) 
+{
+#ifdef VM
+  if (!(inode->data.flags & INODE_JOURNALED))
+    return pagecache_read (inode, buffer, size, offset);
+#endif
+  return inode_read_uncached (inode, buffer, size, offset);
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+   Returns the number of bytes actually written, which may be
+   less than SIZE if an error occurs.
+   With VM, pages of a regular file in the page cache are updated
+   to match. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
+                off_t offset) 
+{
+  off_t bytes_written = inode_write_uncached (inode, buffer, size, offset);
+
+#ifdef VM
+  if (bytes_written > 0 && !(inode->data.flags & INODE_JOURNALED))
+    pagecache_write (inode, buffer, bytes_written, offset);
+#endif
+  return bytes_written;
+}
+
+/* Like inode_read_at(), but bypasses the page cache.
+   INODE's readers-writer lock is held while its data is read, so
+   user memory, whose page faults may need to read INODE, is only
+   copied to from a kernel buffer, after the lock is released. */
 off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
+inode_read_uncached (struct inode *inode, void *buffer_, off_t size,
+                     off_t offset) 
+{
+  uint8_t *buffer = buffer_;
+  off_t bytes_read = 0;
+  uint8_t *bounce;
+
+  if (!is_user_vaddr (buffer))
+    return read_locked (inode, buffer, size, offset);
+
+  bounce = palloc_get_page (0);
+  if (bounce == NULL)
+    return 0;
+  while (size > 0)
+    {
+      off_t chunk_size = size < PGSIZE ? size : PGSIZE;
+      off_t chunk_read = read_locked (inode, bounce, chunk_size, offset);
+
+      memcpy (buffer + bytes_read, bounce, chunk_read);
+      bytes_read += chunk_read;
+      offset += chunk_read;
+      size -= chunk_read;
+      if (chunk_read < chunk_size)
+        break;
+    }
+  palloc_free_page (bounce);
+  return bytes_read;
+}
+
+/* Reads SIZE bytes from INODE into kernel buffer BUFFER_,
+   starting at position OFFSET, holding INODE's lock for
+   reading. */
+static off_t
+read_locked (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
   uint8_t *bounce = NULL;
 
+  rwlock_acquire_read (&inode->rw);
+  if (inode->data.flags & INODE_INLINE)
+    {
+      if (offset >= inode->data.length || size <= 0)
+        size = 0;
+      else if (size > inode->data.length - offset)
+        size = inode->data.length - offset;
+      memcpy (buffer, inode->data.inline_data + offset, size);
+      rwlock_release_read (&inode->rw);
+      return size;
+    }
+
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx = byte_to_sector (inode, offset, false, NULL);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -217,13 +817,31 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 
       /* Number of bytes to actually copy out of this sector. */
       int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
+      if (chunk_size <= 0 || sector_idx == (block_sector_t) -1)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx == 0)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* Hole: reads as zeros, without touching the disk. */
+          memset (buffer + bytes_read, 0, chunk_size);
+        }
+      else if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+        {
+          /* Read full sectors directly into caller's buffer, as
+             many in one request as lie one after another on disk.
+             Only metadata may have newer copies in the journal. */
+          size_t cnt = 1;
+
+          if (!(inode->data.flags & INODE_JOURNALED))
+            cnt = sector_run (inode, offset, sector_idx,
+                              (size < inode_left ? size : inode_left)
+                              / BLOCK_SECTOR_SIZE, false, false, NULL);
+          if (cnt > 1)
+            block_read_multiple (fs_device, sector_idx, cnt,
+                                 buffer + bytes_read);
+          else
+            read_sector (inode, sector_idx, buffer + bytes_read);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
       else 
         {
@@ -235,7 +853,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
               if (bounce == NULL)
                 break;
             }
-          block_read (fs_device, sector_idx, bounce);
+          read_sector (inode, sector_idx, bounce);
           memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
         }
       
@@ -244,68 +862,190 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
+  rwlock_release_read (&inode->rw);
   free (bounce);
 
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
-   Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+/* Like inode_write_at(), but bypasses the page cache.
+   Sectors in holes are allocated as they are first written, and
+   a write past end of file extends the inode, leaving a hole
+   between the old end and OFFSET.
+
+   Writes that extend the file hold INODE's extend_lock
+   throughout, so that they are atomic with respect to each other.
+   Readers cannot see past the old end of file until the new
+   length is set, so such a write holds the readers-writer lock
+   only to change the index, to touch the sector that holds the
+   old end, and to set the new length, and readers of the rest of
+   the file proceed meanwhile.
+
+   As with reads, user memory is copied to a kernel buffer before
+   any lock is taken, a page at a time, so that a large write
+   from user memory is atomic only a page at a time. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
-                off_t offset) 
+inode_write_uncached (struct inode *inode, const void *buffer_, off_t size,
+                      off_t offset) 
+{
+  const uint8_t *buffer = buffer_;
+  off_t bytes_written = 0;
+  uint8_t *bounce;
+
+  if (!is_user_vaddr (buffer))
+    return write_locked (inode, buffer, size, offset);
+
+  bounce = palloc_get_page (0);
+  if (bounce == NULL)
+    return 0;
+  while (size > 0)
+    {
+      off_t chunk_size = size < PGSIZE ? size : PGSIZE;
+      off_t chunk_written;
+
+      memcpy (bounce, buffer + bytes_written, chunk_size);
+      chunk_written = write_locked (inode, bounce, chunk_size, offset);
+      bytes_written += chunk_written;
+      offset += chunk_written;
+      size -= chunk_written;
+      if (chunk_written < chunk_size)
+        break;
+    }
+  palloc_free_page (bounce);
+  return bytes_written;
+}
+
+/* Writes SIZE bytes from kernel buffer BUFFER_ into INODE,
+   starting at OFFSET, as described above. */
+static off_t
+write_locked (struct inode *inode, const void *buffer_, off_t size,
+              off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
   uint8_t *bounce = NULL;
+  bool allocated = false;
+  bool extending;
+  off_t old_length;
 
-  if (inode->deny_write_cnt)
+  if (inode->deny_write_cnt || offset < 0 || size <= 0)
     return 0;
 
+  /* Allocation and growth form one transaction.  The journal
+     handle is taken before the inode's locks, never after: a
+     commit waits for every open handle, and callers such as
+     filesys_create() already hold one when they grow a
+     directory, so a thread holding extend_lock must never wait
+     in journal_begin(). */
+  journal_begin ();
+
+  /* The length only grows, and only under extend_lock, so a write
+     that does not reach past it now never will. */
+  extending = offset + size > inode_length (inode);
+  if (extending)
+    lock_acquire (&inode->extend_lock);
+  old_length = inode_length (inode);
+
+  /* The flag is tested under the lock: an extending writer may
+     move the data out while a write that does not extend waits
+     for it.  A file once moved out stays out, so if the flag is
+     clear here the loop below may index the file. */
+  rwlock_acquire_write (&inode->rw);
+  if (inode->data.flags & INODE_INLINE)
+    {
+      if (offset + size <= (off_t) INLINE_SIZE)
+        {
+          memcpy (inode->data.inline_data + offset, buffer, size);
+          if (offset + size > inode->data.length)
+            inode->data.length = offset + size;
+          journal_write (inode->sector, &inode->data);
+          bytes_written = size;
+          size = 0;
+        }
+      else if (!move_out (inode))
+        size = 0;
+    }
+  rwlock_release_write (&inode->rw);
+
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      block_sector_t sector_idx;
+      bool fresh;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left in sector. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
 
       /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+      int chunk_size = size < sector_left ? size : sector_left;
+
+      /* Readers may see this sector unless it lies wholly past
+         the old end of file. */
+      bool visible = offset - sector_ofs < old_length;
+
+      rwlock_acquire_write (&inode->rw);
+      sector_idx = byte_to_sector (inode, offset, true, &fresh);
+      if (!visible)
+        rwlock_release_write (&inode->rw);
+      if (sector_idx == (block_sector_t) -1)
+        {
+          if (visible)
+            rwlock_release_write (&inode->rw);
+          break;
+        }
+      allocated = allocated || fresh;
 
       if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          /* Write full sectors directly to disk, as many in one
+             request as lie one after another on disk.  A run stays
+             on one side of the old end of file, so that the visible
+             part is written under the lock. */
+          size_t cnt = 1;
+
+          if (!(inode->data.flags & INODE_JOURNALED))
+            {
+              size_t max = size / BLOCK_SECTOR_SIZE;
+              size_t visible_cnt = DIV_ROUND_UP (old_length - offset,
+                                                 BLOCK_SECTOR_SIZE);
+              if (visible && max > visible_cnt)
+                max = visible_cnt;
+              cnt = sector_run (inode, offset, sector_idx, max, true,
+                                !visible, &allocated);
+            }
+          if (cnt > 1)
+            block_write_multiple (fs_device, sector_idx, cnt,
+                                  buffer + bytes_written);
+          else
+            write_sector (inode, sector_idx, buffer + bytes_written);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
       else 
         {
           /* We need a bounce buffer. */
           if (bounce == NULL) 
+            bounce = malloc (BLOCK_SECTOR_SIZE);
+          if (bounce == NULL)
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              if (visible)
+                rwlock_release_write (&inode->rw);
+              break;
             }
 
           /* If the sector contains data before or after the chunk
              we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
+             first.  Otherwise, or if the sector was a hole, we
+             start with a sector of all zeros. */
+          if (!fresh && (sector_ofs > 0 || chunk_size < sector_left))
+            read_sector (inode, sector_idx, bounce);
           else
             memset (bounce, 0, BLOCK_SECTOR_SIZE);
           memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          write_sector (inode, sector_idx, bounce);
         }
+      if (visible)
+        rwlock_release_write (&inode->rw);
 
       /* Advance. */
       size -= chunk_size;
@@ -314,6 +1054,22 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     }
   free (bounce);
 
+  if (offset > inode->data.length && bytes_written > 0)
+    {
+      rwlock_acquire_write (&inode->rw);
+      inode->data.length = offset;
+      journal_write (inode->sector, &inode->data);
+      rwlock_release_write (&inode->rw);
+    }
+
+  /* The free map file is fully allocated when created, and its
+     own writes must not recurse into syncing it. */
+  if (allocated && inode->sector != FREE_MAP_SECTOR)
+    free_map_sync ();
+  journal_end ();
+  if (extending)
+    lock_release (&inode->extend_lock);
+
   return bytes_written;
 }
 
@@ -0,0 +1,727 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Write-ahead journal for file system metadata.
+
+   Inode sectors and the contents of directories and of the free
+   map are metadata.  Instead of writing them in place, the file
+   system hands them to journal_write(), which only keeps the new
+   contents in memory as part of the running transaction.  Every
+   file system operation runs between journal_begin() and
+   journal_end(), so that all of its changes land in the same
+   transaction.
+
+   Transactions are committed in groups: the "journald" thread
+   commits the running transaction every COMMIT_INTERVAL ticks,
+   and journal_end() commits early once it holds TXN_SECTORS
+   sectors.  Committing appends the changed sectors to a circular
+   log on disk, followed by a commit record.  Only later, once
+   the log is half full, does a checkpoint write the sectors to
+   their home locations and free the log.
+
+   When the file system is mounted, every transaction found
+   committed in the log is replayed, which brings the metadata
+   back to the state of the last commit.
+
+   A metadata sector that is freed and reused for file data must
+   not be overwritten by replaying an old copy from the log, so
+   freeing such a sector logs a revoke record for it. */
+
+/* Identifies the journal superblock and log records. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/* Number of sectors in the log. */
+#define JOURNAL_SIZE 256
+
+/* Running transaction size that triggers a commit. */
+#define TXN_SECTORS 64
+
+/* Log sectors in use that trigger a checkpoint. */
+#define CHECKPOINT_SECTORS (JOURNAL_SIZE / 2)
+
+/* Ticks between group commits. */
+#define COMMIT_INTERVAL TIMER_FREQ
+
+/* Types of log records. */
+enum record_type
+  {
+    RECORD_DESC = 1,            /* Sectors whose copies follow. */
+    RECORD_REVOKE,              /* Sectors not to replay any more. */
+    RECORD_COMMIT               /* End of a complete transaction. */
+  };
+
+/* Sector numbers that fit in one log record. */
+#define RECORD_SLOTS ((BLOCK_SECTOR_SIZE - 16) / sizeof (block_sector_t))
+
+/* Log record.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct record
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    uint32_t type;                      /* A RECORD_* value. */
+    uint32_t seq;                       /* Transaction sequence number. */
+    uint32_t cnt;                       /* Entries used in sectors[]. */
+    block_sector_t sectors[RECORD_SLOTS];
+  };
+
+/* Journal superblock, at JOURNAL_SECTOR.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct journal_super
+  {
+    unsigned magic;                     /* JOURNAL_MAGIC. */
+    block_sector_t start;               /* First sector of the log. */
+    uint32_t size;                      /* Sectors in the log. */
+    uint32_t tail;                      /* Log offset of oldest transaction. */
+    uint32_t tail_seq;                  /* Its sequence number. */
+    uint32_t unused[123];               /* Not used. */
+  };
+
+/* A metadata sector whose contents are newer in memory than in
+   its home location. */
+struct jblock
+  {
+    struct hash_elem hash_elem;         /* Element in blocks. */
+    struct list_elem all_elem;          /* Element in all_blocks. */
+    struct list_elem txn_elem;          /* Element in running_blocks. */
+    block_sector_t sector;              /* Home location. */
+    bool running;                       /* Changed in running transaction? */
+    bool committed;                     /* Committed, not checkpointed? */
+    uint8_t *old;                       /* Committed copy, if also running. */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Latest contents. */
+  };
+
+/* A sector revoked by a transaction. */
+struct jrevoke
+  {
+    struct list_elem elem;              /* List element. */
+    block_sector_t sector;              /* Revoked sector. */
+    uint32_t seq;                       /* Revoking transaction. */
+  };
+
+static bool journal_enabled;            /* Is there a journal? */
+static struct journal_super super;      /* Copy of the superblock. */
+
+/* journal_lock protects everything below.  journal_cond is
+   signaled when handle_cnt drops to 0 or a commit finishes. */
+static struct lock journal_lock;
+static struct condition journal_cond;
+
+static struct hash blocks;              /* All jblocks, by sector. */
+static struct list all_blocks;          /* All jblocks. */
+static struct list running_blocks;      /* Running transaction's jblocks. */
+static size_t running_cnt;              /* Length of running_blocks. */
+static struct list running_revokes;     /* Running transaction's revokes. */
+static int handle_cnt;                  /* Operations in progress. */
+static bool committing;                 /* Commit in progress? */
+static uint32_t head;                   /* Log offset to write next. */
+static uint32_t next_seq;               /* Running transaction's number. */
+static size_t log_used;                 /* Log sectors not checkpointed. */
+
+/* Statistics. */
+static long long commit_cnt;            /* Transactions committed. */
+static long long logged_cnt;            /* Sectors written to the log. */
+static long long checkpoint_cnt;        /* Checkpoints taken. */
+static long long replay_cnt;            /* Transactions replayed. */
+
+static void journald (void *aux);
+static void replay (void);
+static void commit (bool checkpoint_all);
+static void write_transaction (void);
+static void checkpoint (void);
+static void drop_block (struct jblock *);
+static struct jblock *lookup (block_sector_t);
+static block_sector_t log_sector (uint32_t pos);
+static bool is_revoked (struct list *, block_sector_t, uint32_t seq);
+
+/* Returns a hash value for the jblock that contains E. */
+static unsigned
+jblock_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct jblock, hash_elem)->sector);
+}
+
+/* Returns true if jblock A's sector precedes jblock B's. */
+static bool
+jblock_less (const struct hash_elem *a, const struct hash_elem *b,
+             void *aux UNUSED)
+{
+  return (hash_entry (a, struct jblock, hash_elem)->sector
+          < hash_entry (b, struct jblock, hash_elem)->sector);
+}
+
+/* Allocates the log and writes an empty journal to a newly
+   formatted file system. */
+void
+journal_create (void)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  struct journal_super *js;
+  block_sector_t start;
+  size_t i;
+
+  /* If this assertion fails, a journal structure is not exactly
+     one sector in size, and you should fix that. */
+  ASSERT (sizeof (struct record) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof *js == BLOCK_SECTOR_SIZE);
+
+  if (!free_map_allocate (JOURNAL_SIZE, &start))
+    PANIC ("journal creation failed");
+
+  /* Clear the log, so that no record from an earlier file system
+     on this disk can pass for one of ours. */
+  for (i = 0; i < JOURNAL_SIZE; i++)
+    block_write (fs_device, start + i, zeros);
+
+  js = calloc (1, sizeof *js);
+  if (js == NULL)
+    PANIC ("journal creation failed");
+  js->magic = JOURNAL_MAGIC;
+  js->start = start;
+  js->size = JOURNAL_SIZE;
+  js->tail = 0;
+  js->tail_seq = 1;
+  block_write (fs_device, JOURNAL_SECTOR, js);
+  free (js);
+}
+
+/* Reads the journal, replays committed transactions, and starts
+   journaling.  A file system without a journal keeps writing its
+   metadata in place. */
+void
+journal_open (void)
+{
+  lock_init (&journal_lock);
+  cond_init (&journal_cond);
+  hash_init (&blocks, jblock_hash, jblock_less, NULL);
+  list_init (&all_blocks);
+  list_init (&running_blocks);
+  list_init (&running_revokes);
+
+  block_read (fs_device, JOURNAL_SECTOR, &super);
+  if (super.magic != JOURNAL_MAGIC || super.size == 0)
+    return;
+
+  replay ();
+  journal_enabled = true;
+  thread_create ("journald", PRI_DEFAULT, journald, NULL);
+}
+
+/* Commits the running transaction and checkpoints everything, so
+   that the home locations are up to date. */
+void
+journal_close (void)
+{
+  if (journal_enabled)
+    commit (true);
+}
+
+/* Starts a file system operation.  Its metadata changes become
+   part of the running transaction, which cannot commit until the
+   matching journal_end().  Calls may nest. */
+void
+journal_begin (void)
+{
+  struct thread *t = thread_current ();
+
+  if (!journal_enabled || t->journal_depth++ > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  while (committing)
+    cond_wait (&journal_cond, &journal_lock);
+  handle_cnt++;
+  lock_release (&journal_lock);
+}
+
+/* Ends a file system operation started by journal_begin(). */
+void
+journal_end (void)
+{
+  struct thread *t = thread_current ();
+  bool full;
+
+  if (!journal_enabled)
+    return;
+  ASSERT (t->journal_depth > 0);
+  if (--t->journal_depth > 0)
+    return;
+
+  lock_acquire (&journal_lock);
+  if (--handle_cnt == 0)
+    cond_broadcast (&journal_cond, &journal_lock);
+  full = running_cnt >= TXN_SECTORS;
+  lock_release (&journal_lock);
+
+  if (full)
+    commit (false);
+}
+
+/* Reads metadata sector SECTOR into BUFFER, taking the latest
+   contents from the journal if it has them. */
+void
+journal_read (block_sector_t sector, void *buffer)
+{
+  struct jblock *b;
+
+  if (journal_enabled)
+    {
+      lock_acquire (&journal_lock);
+      b = lookup (sector);
+      if (b != NULL)
+        {
+          memcpy (buffer, b->data, BLOCK_SECTOR_SIZE);
+          lock_release (&journal_lock);
+          return;
+        }
+      lock_release (&journal_lock);
+    }
+  block_read (fs_device, sector, buffer);
+}
+
+/* Writes BUFFER to metadata sector SECTOR as part of the running
+   transaction. */
+void
+journal_write (block_sector_t sector, const void *buffer)
+{
+  struct list_elem *e;
+  struct jblock *b;
+
+  if (!journal_enabled)
+    {
+      block_write (fs_device, sector, buffer);
+      return;
+    }
+
+  journal_begin ();
+  lock_acquire (&journal_lock);
+  b = lookup (sector);
+  if (b == NULL)
+    {
+      b = malloc (sizeof *b);
+      if (b == NULL)
+        PANIC ("out of memory for the journal");
+      b->sector = sector;
+      b->running = false;
+      b->committed = false;
+      b->old = NULL;
+      hash_insert (&blocks, &b->hash_elem);
+      list_push_back (&all_blocks, &b->all_elem);
+    }
+  if (!b->running)
+    {
+      /* Keep the committed copy for the next checkpoint. */
+      if (b->committed)
+        {
+          b->old = malloc (BLOCK_SECTOR_SIZE);
+          if (b->old == NULL)
+            PANIC ("out of memory for the journal");
+          memcpy (b->old, b->data, BLOCK_SECTOR_SIZE);
+        }
+      b->running = true;
+      list_push_back (&running_blocks, &b->txn_elem);
+      running_cnt++;
+    }
+  memcpy (b->data, buffer, BLOCK_SECTOR_SIZE);
+
+  /* Metadata again: a revoke by this transaction no longer holds. */
+  for (e = list_begin (&running_revokes); e != list_end (&running_revokes);
+       e = list_next (e))
+    {
+      struct jrevoke *r = list_entry (e, struct jrevoke, elem);
+      if (r->sector == sector)
+        {
+          list_remove (e);
+          free (r);
+          break;
+        }
+    }
+  lock_release (&journal_lock);
+  journal_end ();
+}
+
+/* Notes that the CNT sectors starting at SECTOR were freed.
+   Copies of them in the log must not be replayed any more, since
+   the sectors may be reused for file data. */
+void
+journal_revoke (block_sector_t sector, size_t cnt)
+{
+  size_t i;
+
+  if (!journal_enabled)
+    return;
+
+  lock_acquire (&journal_lock);
+  for (i = 0; i < cnt; i++)
+    {
+      struct jblock *b = lookup (sector + i);
+      if (b == NULL)
+        continue;
+
+      /* Only committed copies are in the log. */
+      if (b->committed)
+        {
+          struct jrevoke *r = malloc (sizeof *r);
+          if (r == NULL)
+            PANIC ("out of memory for the journal");
+          r->sector = sector + i;
+          r->seq = next_seq;
+          list_push_back (&running_revokes, &r->elem);
+        }
+      drop_block (b);
+    }
+  lock_release (&journal_lock);
+}
+
+/* Commits the running transaction. */
+void
+journal_commit (void)
+{
+  if (journal_enabled)
+    commit (false);
+}
+
+/* Prints journal statistics. */
+void
+journal_print_stats (void)
+{
+  if (journal_enabled)
+    printf ("Journal: %lld transactions, %lld sectors logged, "
+            "%lld checkpoints, %lld replayed\n",
+            commit_cnt, logged_cnt, checkpoint_cnt, replay_cnt);
+}
+
+/* Group commit thread. */
+static void
+journald (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_sleep (COMMIT_INTERVAL);
+      commit (false);
+    }
+}
+
+/* Waits for the operations in the running transaction to end,
+   then writes it to the log.  Checkpoints if the log is getting
+   full, or always if CHECKPOINT_ALL is true. */
+static void
+commit (bool checkpoint_all)
+{
+  ASSERT (thread_current ()->journal_depth == 0);
+
+  lock_acquire (&journal_lock);
+  while (committing)
+    cond_wait (&journal_cond, &journal_lock);
+  committing = true;
+  while (handle_cnt > 0)
+    cond_wait (&journal_cond, &journal_lock);
+
+  if (running_cnt > 0 || !list_empty (&running_revokes))
+    write_transaction ();
+  if (checkpoint_all || log_used >= CHECKPOINT_SECTORS)
+    checkpoint ();
+
+  committing = false;
+  cond_broadcast (&journal_cond, &journal_lock);
+  lock_release (&journal_lock);
+}
+
+/* Writes the running transaction to the log: its revoke records,
+   then descriptor records each followed by the sectors they
+   list, then a commit record.  journal_lock must be held. */
+static void
+write_transaction (void)
+{
+  static struct record rec;
+  size_t revoke_cnt = list_size (&running_revokes);
+  size_t needed = (DIV_ROUND_UP (revoke_cnt, RECORD_SLOTS)
+                   + DIV_ROUND_UP (running_cnt, RECORD_SLOTS)
+                   + running_cnt + 1);
+  struct list_elem *e;
+  uint32_t pos = head;
+
+  if (needed > super.size - log_used)
+    checkpoint ();
+  if (needed > super.size)
+    {
+      /* Too big for the log: write it in place, without the
+         guarantee of atomicity. */
+      while (!list_empty (&running_blocks))
+        {
+          struct jblock *b = list_entry (list_front (&running_blocks),
+                                         struct jblock, txn_elem);
+          block_write (fs_device, b->sector, b->data);
+          drop_block (b);
+        }
+      while (!list_empty (&running_revokes))
+        free (list_entry (list_pop_front (&running_revokes),
+                          struct jrevoke, elem));
+      return;
+    }
+
+  rec.magic = JOURNAL_MAGIC;
+  rec.seq = next_seq;
+
+  /* Revoke records. */
+  rec.type = RECORD_REVOKE;
+  while (!list_empty (&running_revokes))
+    {
+      rec.cnt = 0;
+      while (rec.cnt < RECORD_SLOTS && !list_empty (&running_revokes))
+        {
+          struct jrevoke *r = list_entry (list_pop_front (&running_revokes),
+                                          struct jrevoke, elem);
+          rec.sectors[rec.cnt++] = r->sector;
+          free (r);
+        }
+      block_write (fs_device, log_sector (pos++), &rec);
+    }
+
+  /* Descriptor records and sector copies. */
+  rec.type = RECORD_DESC;
+  e = list_begin (&running_blocks);
+  while (e != list_end (&running_blocks))
+    {
+      struct list_elem *first = e;
+      uint32_t desc_pos = pos++;
+
+      rec.cnt = 0;
+      for (; e != list_end (&running_blocks) && rec.cnt < RECORD_SLOTS;
+           e = list_next (e))
+        rec.sectors[rec.cnt++] = list_entry (e, struct jblock,
+                                             txn_elem)->sector;
+      block_write (fs_device, log_sector (desc_pos), &rec);
+      for (; first != e; first = list_next (first))
+        block_write (fs_device, log_sector (pos++),
+                     list_entry (first, struct jblock, txn_elem)->data);
+    }
+
+  /* The commit record goes last, after everything it vouches
+     for has reached the disk. */
+  rec.type = RECORD_COMMIT;
+  rec.cnt = needed;
+  block_write (fs_device, log_sector (pos++), &rec);
+
+  head = pos % super.size;
+  log_used += needed;
+  next_seq++;
+  commit_cnt++;
+  logged_cnt += running_cnt;
+
+  while (!list_empty (&running_blocks))
+    {
+      struct jblock *b = list_entry (list_pop_front (&running_blocks),
+                                     struct jblock, txn_elem);
+      b->running = false;
+      b->committed = true;
+      free (b->old);
+      b->old = NULL;
+    }
+  running_cnt = 0;
+}
+
+/* Writes every committed sector to its home location, then frees
+   the log by moving its tail up to the head.  journal_lock must
+   be held. */
+static void
+checkpoint (void)
+{
+  struct list_elem *e, *next;
+
+  for (e = list_begin (&all_blocks); e != list_end (&all_blocks); e = next)
+    {
+      struct jblock *b = list_entry (e, struct jblock, all_elem);
+
+      next = list_next (e);
+      if (!b->committed)
+        continue;
+      block_write (fs_device, b->sector, b->old != NULL ? b->old : b->data);
+      b->committed = false;
+      free (b->old);
+      b->old = NULL;
+      if (!b->running)
+        drop_block (b);
+    }
+
+  super.tail = head;
+  super.tail_seq = next_seq;
+  block_write (fs_device, JOURNAL_SECTOR, &super);
+  log_used = 0;
+  checkpoint_cnt++;
+}
+
+/* Replays the committed transactions in the log, in two passes:
+   the first finds them and collects their revoke records, the
+   second copies their sectors home unless revoked later.  Then
+   empties the log. */
+static void
+replay (void)
+{
+  struct record *rec = malloc (sizeof *rec);
+  uint8_t *buf = malloc (BLOCK_SECTOR_SIZE);
+  struct list revokes, txn_revokes;
+  uint32_t pos, seq, end_pos;
+  uint32_t txn;
+
+  if (rec == NULL || buf == NULL)
+    PANIC ("out of memory for journal replay");
+  list_init (&revokes);
+  list_init (&txn_revokes);
+
+  /* Pass 1: find the committed transactions. */
+  pos = end_pos = super.tail;
+  seq = super.tail_seq;
+  for (;;)
+    {
+      uint32_t len = 0;
+      bool complete = false;
+
+      while (len < super.size)
+        {
+          block_read (fs_device, log_sector (pos), rec);
+          if (rec->magic != JOURNAL_MAGIC || rec->seq != seq
+              || rec->cnt > RECORD_SLOTS)
+            break;
+          if (rec->type == RECORD_DESC)
+            {
+              pos = (pos + 1 + rec->cnt) % super.size;
+              len += 1 + rec->cnt;
+            }
+          else if (rec->type == RECORD_REVOKE)
+            {
+              uint32_t i;
+              for (i = 0; i < rec->cnt; i++)
+                {
+                  struct jrevoke *r = malloc (sizeof *r);
+                  if (r == NULL)
+                    PANIC ("out of memory for journal replay");
+                  r->sector = rec->sectors[i];
+                  r->seq = seq;
+                  list_push_back (&txn_revokes, &r->elem);
+                }
+              pos = (pos + 1) % super.size;
+              len++;
+            }
+          else if (rec->type == RECORD_COMMIT)
+            {
+              pos = (pos + 1) % super.size;
+              complete = true;
+              break;
+            }
+          else
+            break;
+        }
+
+      if (!complete)
+        break;
+      while (!list_empty (&txn_revokes))
+        list_push_back (&revokes, list_pop_front (&txn_revokes));
+      end_pos = pos;
+      seq++;
+    }
+  while (!list_empty (&txn_revokes))
+    free (list_entry (list_pop_front (&txn_revokes), struct jrevoke, elem));
+
+  /* Pass 2: copy their sectors home. */
+  pos = super.tail;
+  for (txn = super.tail_seq; txn < seq; )
+    {
+      block_read (fs_device, log_sector (pos), rec);
+      pos = (pos + 1) % super.size;
+      if (rec->type == RECORD_DESC)
+        {
+          uint32_t i;
+          for (i = 0; i < rec->cnt; i++)
+            {
+              if (!is_revoked (&revokes, rec->sectors[i], txn))
+                {
+                  block_read (fs_device, log_sector (pos), buf);
+                  block_write (fs_device, rec->sectors[i], buf);
+                }
+              pos = (pos + 1) % super.size;
+            }
+        }
+      else if (rec->type == RECORD_COMMIT)
+        {
+          replay_cnt++;
+          txn++;
+        }
+    }
+  while (!list_empty (&revokes))
+    free (list_entry (list_pop_front (&revokes), struct jrevoke, elem));
+  free (rec);
+  free (buf);
+
+  if (replay_cnt > 0)
+    printf ("Journal: replayed %lld transactions.\n", replay_cnt);
+
+  /* Start over with an empty log. */
+  head = end_pos;
+  next_seq = seq;
+  super.tail = head;
+  super.tail_seq = next_seq;
+  block_write (fs_device, JOURNAL_SECTOR, &super);
+  log_used = 0;
+}
+
+/* Forgets B.  journal_lock must be held. */
+static void
+drop_block (struct jblock *b)
+{
+  if (b->running)
+    {
+      list_remove (&b->txn_elem);
+      running_cnt--;
+    }
+  hash_delete (&blocks, &b->hash_elem);
+  list_remove (&b->all_elem);
+  free (b->old);
+  free (b);
+}
+
+/* Returns the jblock for SECTOR, or a null pointer if there is
+   none.  journal_lock must be held. */
+static struct jblock *
+lookup (block_sector_t sector)
+{
+  struct jblock key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&blocks, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct jblock, hash_elem) : NULL;
+}
+
+/* Returns the device sector at log offset POS. */
+static block_sector_t
+log_sector (uint32_t pos)
+{
+  return super.start + pos % super.size;
+}
+
+/* Returns true if REVOKES holds a revoke record for SECTOR from
+   transaction SEQ or a later one. */
+static bool
+is_revoked (struct list *revokes, block_sector_t sector, uint32_t seq)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (revokes); e != list_end (revokes); e = list_next (e))
+    {
+      struct jrevoke *r = list_entry (e, struct jrevoke, elem);
+      if (r->sector == sector && r->seq >= seq)
+        return true;
+    }
+  return false;
+}
@@ -0,0 +1,45 @@
+#ifndef __LIB_BLKSTAT_H
+#define __LIB_BLKSTAT_H
+
+/* Classes of block device users.  A request counts toward the
+   role of the device it was submitted to, so that requests from
+   the file system and swap to partitions of one disk are told
+   apart. */
+enum blkstat_class
+  {
+    BLKSTAT_KERNEL,             /* Kernel image. */
+    BLKSTAT_FILESYS,            /* File system. */
+    BLKSTAT_SCRATCH,            /* Scratch. */
+    BLKSTAT_SWAP,               /* Swap. */
+    BLKSTAT_OTHER,              /* Devices with no role. */
+    BLKSTAT_CLASS_CNT
+  };
+
+/* Histogram buckets.  Bucket 0 counts zeros, and bucket I > 0
+   counts values from 2**(I - 1) up to 2**I - 1.  The last bucket
+   also counts anything bigger. */
+#define BLKSTAT_BUCKETS 20
+
+/* Latencies in TSC cycles are counted in units of this many. */
+#define BLKSTAT_CYCLES_UNIT 1024
+
+/* Block I/O of one class of users, summed over all devices, as
+   reported by the blkstat system call.  Latency runs from
+   submission of a request to its completion, so it includes time
+   spent waiting in the device's queue. */
+struct blkstat
+  {
+    unsigned long long requests;        /* Requests completed. */
+    unsigned long long read_sectors;    /* Sectors read. */
+    unsigned long long write_sectors;   /* Sectors written. */
+    unsigned long long sequential;      /* Requests that needed no seek. */
+    unsigned long long seek_total;      /* Sum of seek distances. */
+    unsigned long long cycles_total;    /* Sum of latencies in cycles. */
+    unsigned long long ticks_total;     /* Sum of latencies in ticks. */
+    unsigned cycles_hist[BLKSTAT_BUCKETS]; /* Latency, in CYCLES_UNITs. */
+    unsigned ticks_hist[BLKSTAT_BUCKETS];  /* Latency, in timer ticks. */
+    unsigned size_hist[BLKSTAT_BUCKETS];   /* Request size, in sectors. */
+    unsigned depth_hist[BLKSTAT_BUCKETS];  /* Requests queued ahead. */
+  };
+
+#endif /* lib/blkstat.h */
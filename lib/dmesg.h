@@ -0,0 +1,13 @@
+#ifndef __LIB_DMESG_H
+#define __LIB_DMESG_H
+
+/* Where the dmesg system call copies the kernel log: up to SIZE
+   bytes of its most recent lines, each "<L>TEXT\n" with L the
+   digit of the message's level, into BUFFER. */
+struct dmesg_args
+  {
+    char *buffer;               /* Destination. */
+    unsigned size;              /* Bytes of room in BUFFER. */
+  };
+
+#endif /* lib/dmesg.h */
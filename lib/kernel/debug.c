@@ -1,5 +1,6 @@
 #include <debug.h>
 #include <console.h>
+#include <klog.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -28,6 +29,8 @@ debug_panic (const char *file, int line, const char *function,
   level++;
   if (level == 1) 
     {
+      /* Messages still in the log may explain the panic. */
+      klog_flush ();
       printf ("Kernel PANIC at %s:%d in %s(): ", file, line, function);
 
       va_start (args, message);
@@ -0,0 +1,223 @@
+#include <klog.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* The kernel log keeps recent messages in a ring in memory.
+   Logging a message only formats it and copies it in, so verbose
+   paths cost little more than a memcpy; a background thread
+   prints messages to the console later, and whatever it has not
+   printed yet is flushed at power off and on a kernel panic.
+
+   Each message is stored as one line "<L>TEXT\n", where L is the
+   digit of its level.  When the ring is full, the oldest messages
+   are overwritten. */
+
+/* Longest line kept, including "<L>" and the new-line.  Longer
+   messages are truncated. */
+#define MAX_LINE 160
+
+static char ring[KLOG_SIZE];
+
+/* Bytes ever appended to the ring, and bytes of that taken by the
+   console, which trails behind.  Both wrap modulo KLOG_SIZE and
+   change only with interrupts off. */
+static unsigned long head;
+static unsigned long flushed;
+
+enum klog_level klog_level = KLOG_DEBUG;
+enum klog_level klog_console_level = KLOG_INFO;
+
+/* Upped when there may be messages to print. */
+static struct semaphore pending;
+static bool flusher_started;
+
+/* Statistics. */
+static long long message_cnt;   /* Messages logged. */
+static long long lost_cnt;      /* Bytes overwritten before printing. */
+
+static const char *level_names[KLOG_LEVEL_CNT] =
+  {"err", "warn", "info", "debug"};
+
+static size_t take_line (char line[MAX_LINE]);
+static void print_line (const char *, size_t);
+static thread_func flush_thread NO_RETURN;
+
+/* Starts the thread that prints the log to the console.  Until
+   it runs, messages accumulate in the ring. */
+void
+klog_init (void) 
+{
+  sema_init (&pending, 0);
+  thread_create ("klog", PRI_DEFAULT, flush_thread, NULL);
+  flusher_started = true;
+}
+
+/* Logs a message at LEVEL, formatted as by printf(). */
+void
+klog (enum klog_level level, const char *format, ...) 
+{
+  char line[MAX_LINE];
+  enum intr_level old_level;
+  va_list args;
+  size_t len, i;
+  int text_len;
+
+  if (level > klog_level)
+    return;
+
+  /* Format, leaving room for the prefix and a new-line, and keep
+     the message to one line. */
+  va_start (args, format);
+  text_len = vsnprintf (line + 3, MAX_LINE - 4, format, args);
+  va_end (args);
+  if (text_len < 0)
+    return;
+  if (text_len > MAX_LINE - 5)
+    text_len = MAX_LINE - 5;
+  line[0] = '<';
+  line[1] = '0' + level;
+  line[2] = '>';
+  len = 3 + text_len;
+  for (i = 3; i + 1 < len; i++)
+    if (line[i] == '\n')
+      line[i] = ' ';
+  if (line[len - 1] != '\n')
+    line[len++] = '\n';
+
+  old_level = intr_disable ();
+  for (i = 0; i < len; i++)
+    ring[head++ % KLOG_SIZE] = line[i];
+  message_cnt++;
+  intr_set_level (old_level);
+
+  if (flusher_started && level <= klog_console_level)
+    sema_up (&pending);
+}
+
+/* Prints every message that the background thread has not
+   printed yet.  Used at power off and on panic, when that thread
+   will not get another chance. */
+void
+klog_flush (void) 
+{
+  char line[MAX_LINE];
+  size_t len;
+
+  while ((len = take_line (line)) > 0)
+    print_line (line, len);
+}
+
+/* Copies the most recent messages in the log, up to SIZE bytes
+   of them, into BUFFER, and returns the number of bytes copied.
+   The copy starts at the beginning of a line. */
+size_t
+klog_read (char *buffer, size_t size) 
+{
+  enum intr_level old_level = intr_disable ();
+  unsigned long start = head > KLOG_SIZE ? head - KLOG_SIZE : 0;
+  size_t len, i;
+
+  if (head - start > size)
+    start = head - size;
+
+  /* Unless the copy starts at the very first message, skip to
+     the beginning of a line. */
+  if (start > 0)
+    {
+      while (start != head && ring[start % KLOG_SIZE] != '\n')
+        start++;
+      if (start != head)
+        start++;
+    }
+
+  len = head - start;
+  for (i = 0; i < len; i++)
+    buffer[i] = ring[(start + i) % KLOG_SIZE];
+  intr_set_level (old_level);
+
+  return len;
+}
+
+/* Parses NAME, which is a level's digit or its name ("err",
+   "warn", "info" or "debug"), into *LEVEL.  Returns true if
+   successful, false if NAME is not a level. */
+bool
+klog_parse_level (const char *name, enum klog_level *level) 
+{
+  int i;
+
+  for (i = 0; i < KLOG_LEVEL_CNT; i++)
+    if (!strcmp (name, level_names[i])
+        || (name[0] == '0' + i && name[1] == '\0'))
+      {
+        *level = i;
+        return true;
+      }
+  return false;
+}
+
+/* Prints kernel log statistics. */
+void
+klog_print_stats (void) 
+{
+  printf ("Klog: %lld messages, %lld bytes lost before printing\n",
+          message_cnt, lost_cnt);
+}
+
+/* Removes the oldest line not yet taken for the console from the
+   ring into LINE and returns its length, or returns 0 if there is
+   none.  Lines overwritten before they could be taken are lost,
+   along with the partial line left at the start of the ring. */
+static size_t
+take_line (char line[MAX_LINE]) 
+{
+  enum intr_level old_level = intr_disable ();
+  size_t len = 0;
+
+  if (head - flushed > KLOG_SIZE)
+    {
+      unsigned long start = head - KLOG_SIZE;
+
+      while (start != head && ring[start % KLOG_SIZE] != '\n')
+        start++;
+      if (start != head)
+        start++;
+      lost_cnt += start - flushed;
+      flushed = start;
+    }
+
+  while (flushed != head && len < MAX_LINE)
+    {
+      char c = ring[flushed++ % KLOG_SIZE];
+      line[len++] = c;
+      if (c == '\n')
+        break;
+    }
+  intr_set_level (old_level);
+
+  return len;
+}
+
+/* Prints LINE, LEN bytes long and in the ring's format, without
+   its prefix, if its level is severe enough for the console. */
+static void
+print_line (const char *line, size_t len) 
+{
+  if (len > 3 && line[0] == '<' && line[1] - '0' <= (int) klog_console_level)
+    putbuf (line + 3, len - 3);
+}
+
+/* Prints messages to the console as they arrive. */
+static void
+flush_thread (void *aux UNUSED) 
+{
+  for (;;) 
+    {
+      sema_down (&pending);
+      klog_flush ();
+    }
+}
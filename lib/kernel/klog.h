@@ -0,0 +1,34 @@
+#ifndef __LIB_KERNEL_KLOG_H
+#define __LIB_KERNEL_KLOG_H
+
+#include <debug.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Bytes of messages the log keeps.  Must be a power of 2. */
+#define KLOG_SIZE 16384
+
+/* Kernel log levels, most severe first. */
+enum klog_level
+  {
+    KLOG_ERR,                   /* Something has gone wrong. */
+    KLOG_WARN,                  /* Something may go wrong. */
+    KLOG_INFO,                  /* Normal but noteworthy. */
+    KLOG_DEBUG,                 /* Detail for debugging. */
+    KLOG_LEVEL_CNT
+  };
+
+/* Messages less severe than KLOG_LEVEL are discarded; of the
+   rest, those less severe than KLOG_CONSOLE_LEVEL are kept in the
+   log but not printed.  Both may change at any time. */
+extern enum klog_level klog_level;
+extern enum klog_level klog_console_level;
+
+void klog_init (void);
+void klog (enum klog_level, const char *format, ...) PRINTF_FORMAT (2, 3);
+void klog_flush (void);
+size_t klog_read (char *, size_t size);
+bool klog_parse_level (const char *, enum klog_level *);
+void klog_print_stats (void);
+
+#endif /* lib/kernel/klog.h */
@@ -0,0 +1,17 @@
+#ifndef __LIB_MEMSTAT_H
+#define __LIB_MEMSTAT_H
+
+/* Memory usage of a process, as reported by the memstat system
+   call.  Sizes are in pages. */
+struct memstat
+  {
+    unsigned rss;               /* Frames currently resident. */
+    unsigned rss_peak;          /* Most frames ever resident. */
+    unsigned ws;                /* Working set estimate. */
+    unsigned rss_soft;          /* Soft resident set limit, 0 if none. */
+    unsigned rss_hard;          /* Hard resident set limit, 0 if none. */
+    unsigned page_faults;       /* Pages brought in on faults. */
+    unsigned pages_evicted;     /* Frames taken away by eviction. */
+  };
+
+#endif /* lib/memstat.h */
@@ -28,6 +28,13 @@ enum syscall_number
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+
+    /* Extensions. */
+    SYS_MEMSTAT,                /* Reports memory usage of this process. */
+    SYS_BLKSTAT,                /* Reports block I/O statistics. */
+    SYS_DMESG,                  /* Reads the kernel log. */
+    SYS_TTYMODE,                /* Sets the console's terminal mode. */
+    SYS_CLOCK                   /* Reads the nanosecond clock. */
   };
 #endif /* lib/syscall-nr.h */
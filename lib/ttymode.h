@@ -0,0 +1,16 @@
+#ifndef __LIB_TTYMODE_H
+#define __LIB_TTYMODE_H
+
+/* Console terminal mode flags, as set by the ttymode system
+   call. */
+#define TTY_CANON 0x1   /* Canonical: read() returns edited lines. */
+#define TTY_ECHO 0x2    /* Echo input back to the console. */
+
+/* Mode at boot. */
+#define TTY_DEFAULT (TTY_CANON | TTY_ECHO)
+
+/* Longest line a canonical read returns, including its new-line.
+   A read at least this large always takes a whole line. */
+#define TTY_LINE_MAX 256
+
+#endif /* lib/ttymode.h */
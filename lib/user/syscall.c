@@ -182,3 +182,40 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+memstat (struct memstat *ms)
+{
+  return syscall1 (SYS_MEMSTAT, ms);
+}
+
+bool
+blkstat (struct blkstat st[BLKSTAT_CLASS_CNT])
+{
+  return syscall1 (SYS_BLKSTAT, st);
+}
+
+int
+dmesg (char *buffer, unsigned size)
+{
+  struct dmesg_args args;
+
+  args.buffer = buffer;
+  args.size = size;
+  return syscall1 (SYS_DMESG, &args);
+}
+
+int
+ttymode (int mode)
+{
+  return syscall1 (SYS_TTYMODE, mode);
+}
+
+int64_t
+clock_ns (void)
+{
+  int64_t ns;
+
+  syscall1 (SYS_CLOCK, &ns);
+  return ns;
+}
@@ -2,7 +2,12 @@
 #define __LIB_USER_SYSCALL_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <debug.h>
+#include <blkstat.h>
+#include <dmesg.h>
+#include <memstat.h>
+#include <ttymode.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -45,4 +50,11 @@ bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
 
+/* Extensions. */
+bool memstat (struct memstat *);
+bool blkstat (struct blkstat[BLKSTAT_CLASS_CNT]);
+int dmesg (char *buffer, unsigned size);
+int ttymode (int mode);
+int64_t clock_ns (void);
+
 #endif /* lib/user/syscall.h */
@@ -0,0 +1,42 @@
+/* Child process for syn-grow.
+   Grows one file a sector at a time, while the other children
+   grow theirs. */
+
+#include <random.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/filesys/extended/syn-grow.h"
+#include "tests/lib.h"
+
+const char *test_name = "child-syn-grow";
+
+static char buf[BUF_SIZE];
+
+int
+main (int argc, const char *argv[]) 
+{
+  char file_name[16];
+  int child_idx;
+  size_t ofs;
+  int fd;
+
+  quiet = true;
+
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  snprintf (file_name, sizeof file_name, "file%d", child_idx);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    CHECK (write (fd, buf + FILE_SIZE * child_idx + ofs, CHUNK_SIZE)
+           == CHUNK_SIZE,
+           "write %d bytes at offset %zu in \"%s\"",
+           (int) CHUNK_SIZE, ofs, file_name);
+  close (fd);
+
+  return child_idx;
+}
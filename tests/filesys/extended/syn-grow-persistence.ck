@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+my ($data) = random_bytes (4 * 512 * 32);
+my ($size) = 512 * 32;
+check_archive ({"child-syn-grow" => "tests/filesys/extended/child-syn-grow",
+		"file0" => [substr ($data, 0, $size)],
+		"file1" => [substr ($data, $size, $size)],
+		"file2" => [substr ($data, 2 * $size, $size)],
+		"file3" => [substr ($data, 3 * $size, $size)]});
+pass;
@@ -0,0 +1,37 @@
+/* Spawns several child processes that each grow a different file
+   at the same time, so that they allocate sectors concurrently,
+   then verifies the contents of every file. */
+
+#include <random.h>
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/filesys/extended/syn-grow.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[BUF_SIZE];
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_CNT];
+  char file_name[16];
+  int i;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "file%d", i);
+      CHECK (create (file_name, 0), "create \"%s\"", file_name);
+    }
+
+  exec_children ("child-syn-grow", children, CHILD_CNT);
+  wait_children (children, CHILD_CNT);
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      snprintf (file_name, sizeof file_name, "file%d", i);
+      check_file (file_name, buf + FILE_SIZE * i, FILE_SIZE);
+    }
+}
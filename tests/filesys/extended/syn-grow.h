@@ -0,0 +1,10 @@
+#ifndef TESTS_FILESYS_EXTENDED_SYN_GROW_H
+#define TESTS_FILESYS_EXTENDED_SYN_GROW_H
+
+#define CHILD_CNT 4
+#define CHUNK_SIZE 512
+#define CHUNK_CNT 32
+#define FILE_SIZE (CHUNK_SIZE * CHUNK_CNT)
+#define BUF_SIZE (CHILD_CNT * FILE_SIZE)
+
+#endif /* tests/filesys/extended/syn-grow.h */
@@ -0,0 +1,55 @@
+/* Streams through more memory than the process may keep
+   resident, so that pages go out to swap, then checks that
+   blkstat() counted the swap traffic in page-sized requests. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (2 * 1024 * 1024)
+
+/* Sectors in a page, and the size histogram bucket counting
+   requests of that many sectors. */
+#define PAGE_SECTORS 8
+#define PAGE_BUCKET 4
+
+static char buf[SIZE];
+static struct blkstat st[BLKSTAT_CLASS_CNT];
+
+void
+test_main (void)
+{
+  const struct blkstat *swap = &st[BLKSTAT_SWAP];
+  unsigned long long sized;
+  struct arc4 arc4;
+  size_t i;
+
+  msg ("stream");
+  memset (buf, 0x5a, sizeof buf);
+  arc4_init (&arc4, "foobar", 6);
+  arc4_crypt (&arc4, buf, SIZE);
+  arc4_init (&arc4, "foobar", 6);
+  arc4_crypt (&arc4, buf, SIZE);
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 0x5a)
+      fail ("byte %zu != 0x5a", i);
+
+  CHECK (blkstat (st), "blkstat");
+  if (swap->write_sectors == 0 || swap->read_sectors == 0)
+    fail ("no swap traffic: %llu sectors read, %llu written",
+          swap->read_sectors, swap->write_sectors);
+  if (swap->size_hist[PAGE_BUCKET] == 0)
+    fail ("no %d-sector swap requests", PAGE_SECTORS);
+  if ((swap->read_sectors + swap->write_sectors) % PAGE_SECTORS != 0)
+    fail ("swap sectors %llu not a multiple of %d",
+          swap->read_sectors + swap->write_sectors, PAGE_SECTORS);
+
+  sized = 0;
+  for (i = 0; i < BLKSTAT_BUCKETS; i++)
+    sized += swap->size_hist[i];
+  if (sized != swap->requests || swap->sequential > swap->requests)
+    fail ("inconsistent blkstat: %llu requests, %llu sized, "
+          "%llu sequential", swap->requests, sized, swap->sequential);
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-blkstat) begin
+(page-blkstat) stream
+(page-blkstat) blkstat
+(page-blkstat) end
+EOF
+pass;
@@ -0,0 +1,50 @@
+/* Runs 2 child-linear processes next to a process that streams
+   through more memory than it may keep resident, then checks
+   that memstat() held the streaming process to its resident set
+   limit. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 2
+#define SIZE (2 * 1024 * 1024)
+
+static char buf[SIZE];
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  struct memstat ms;
+  struct arc4 arc4;
+  size_t i;
+
+  for (i = 0; i < CHILD_CNT; i++) 
+    CHECK ((children[i] = exec ("child-linear")) != -1,
+           "exec \"child-linear\"");
+
+  /* Stream through BUF while the children run. */
+  msg ("stream");
+  memset (buf, 0x5a, sizeof buf);
+  arc4_init (&arc4, "foobar", 6);
+  arc4_crypt (&arc4, buf, SIZE);
+  arc4_init (&arc4, "foobar", 6);
+  arc4_crypt (&arc4, buf, SIZE);
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != 0x5a)
+      fail ("byte %zu != 0x5a", i);
+
+  CHECK (memstat (&ms), "memstat");
+  if (ms.rss_hard != 0 && ms.rss_peak > ms.rss_hard)
+    fail ("peak resident set %u exceeds hard limit %u",
+          ms.rss_peak, ms.rss_hard);
+  if (ms.rss > ms.rss_peak || ms.page_faults < SIZE / 4096)
+    fail ("inconsistent memstat: rss %u, peak %u, %u faults",
+          ms.rss, ms.rss_peak, ms.page_faults);
+
+  for (i = 0; i < CHILD_CNT; i++) 
+    CHECK (wait (children[i]) == 0x42, "wait for child %zu", i);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-mixed) begin
+(page-mixed) exec "child-linear"
+(page-mixed) exec "child-linear"
+(page-mixed) stream
+(page-mixed) memstat
+(page-mixed) wait for child 0
+(page-mixed) wait for child 1
+(page-mixed) end
+EOF
+pass;
@@ -2,6 +2,7 @@
 #include <console.h>
 #include <debug.h>
 #include <inttypes.h>
+#include <klog.h>
 #include <limits.h>
 #include <random.h>
 #include <stddef.h>
@@ -13,6 +14,7 @@
 #include "devices/serial.h"
 #include "devices/shutdown.h"
 #include "devices/timer.h"
+#include "devices/tty.h"
 #include "devices/vga.h"
 #include "devices/rtc.h"
 #include "threads/interrupt.h"
@@ -34,11 +36,15 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/virtio-blk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
 #ifdef VM
 #include "vm/frame.h"
+#include "vm/merge.h"
+#include "vm/pagecache.h"
 #include "vm/swap.h"
 #endif
 
@@ -53,6 +59,10 @@ static bool format_filesys;
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
+
+/* -ramdisk: Size of the RAM disk to create, in kB, or 0 for
+   none. */
+static size_t ramdisk_kb;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
@@ -63,6 +73,7 @@ static size_t user_page_limit = SIZE_MAX;
 
 static void bss_init (void);
 static void paging_init (void);
+static uint32_t cpu_features (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
@@ -102,13 +113,10 @@ main (void)
   palloc_init (user_page_limit);
   malloc_init ();
   paging_init ();
-<<<<<<< HEAD
 #ifdef VM
   frame_table_init();
+  pagecache_init ();
 #endif
-=======
-  //frame_table_init();
->>>>>>> vm
 
   /* Segmentation. */
 #ifdef USERPROG
@@ -121,6 +129,7 @@ main (void)
   timer_init ();
   kbd_init ();
   input_init ();
+  tty_init ();
 #ifdef USERPROG
   exception_init ();
   syscall_init ();
@@ -129,15 +138,26 @@ main (void)
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
   serial_init_queue ();
+  klog_init ();
   timer_calibrate ();
+#ifdef VM
+  merge_init ();
+#endif
 
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  virtio_blk_init ();
+  if (ramdisk_kb > 0)
+    ramdisk_init (ramdisk_kb * 1024);
   locate_block_devices ();
   filesys_init (format_filesys);
   swap_init();
 #endif
+
+  /* Print boot messages still in the log now, rather than in the
+     middle of whatever the actions print. */
+  klog_flush ();
   printf ("Boot complete.\n");
   
   /* Run actions specified on kernel command line. */
@@ -162,14 +182,27 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+#define CR4_PSE   0x00000010    /* Page Size Extensions. */
+#define CR4_PGE   0x00000080    /* Page Global Enable. */
+#define CPUID_PSE 0x00000008    /* CPUID(1).EDX: 4 MB pages supported. */
+#define CPUID_PGE 0x00002000    /* CPUID(1).EDX: global pages supported. */
+
 /* Populates the base page directory and page table with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   Where the CPU allows it, every 4 MB of RAM that lies wholly
+   inside physical memory and holds no kernel text is mapped
+   with a single 4 MB page, which needs no page table and only
+   one TLB entry. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
+  uint32_t features = cpu_features ();
+  uint32_t cr4;
+  bool pse = (features & CPUID_PSE) != 0;
   size_t page;
   extern char _start, _end_kernel_text;
 
@@ -183,21 +216,53 @@ paging_init (void)
       size_t pte_idx = pt_no (vaddr);
       bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
 
+      if (pse && pte_idx == 0
+          && page + PTSPAN / PGSIZE <= init_ram_pages
+          && (vaddr + PTSPAN <= &_start || vaddr >= &_end_kernel_text))
+        {
+          pd[pde_idx] = pde_create_large (vaddr, true) | PTE_G;
+          page += PTSPAN / PGSIZE - 1;
+          continue;
+        }
+
       if (pd[pde_idx] == 0)
         {
           pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
           pd[pde_idx] = pde_create (pt);
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      /* The kernel mapping is the same in every page directory,
+         so it can be global and survive CR3 reloads. */
+      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text) | PTE_G;
     }
 
+  /* 4 MB PDEs are only understood with CR4.PSE set, so turn it on
+     before they go live.  PGE makes the CPU honor PTE_G.  See
+     [IA32-v3a] 3.6.1 "Paging Options" and 3.12 "Translation
+     Lookaside Buffers (TLBs)". */
+  asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+  if (pse)
+    cr4 |= CR4_PSE;
+  asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+
   /* Store the physical address of the page directory into CR3
      aka PDBR (page directory base register).  This activates our
      new page tables immediately.  See [IA32-v2a] "MOV--Move
      to/from Control Registers" and [IA32-v3a] 3.7.5 "Base Address
      of the Page Directory". */
   asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)));
+
+  if (features & CPUID_PGE)
+    asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PGE) : "memory");
+}
+
+/* Returns the feature flags that CPUID leaf 1 reports in EDX. */
+static uint32_t
+cpu_features (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+  asm volatile ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return edx;
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -259,6 +324,8 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -268,9 +335,30 @@ parse_options (char **argv)
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-serial-lossy"))
+        serial_lossy = true;
+      else if (!strcmp (name, "-klog"))
+        {
+          if (value == NULL || !klog_parse_level (value, &klog_level))
+            PANIC ("bad log level `%s' for -klog", value);
+        }
+      else if (!strcmp (name, "-klog-console"))
+        {
+          if (value == NULL
+              || !klog_parse_level (value, &klog_console_level))
+            PANIC ("bad log level `%s' for -klog-console", value);
+        }
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-merge"))
+        merge_enabled = true;
+      else if (!strcmp (name, "-rss-soft"))
+        frame_rss_soft = atoi (value);
+      else if (!strcmp (name, "-rss-hard"))
+        frame_rss_hard = atoi (value);
 #endif
       else
         PANIC ("unknown option `%s' (use -h for help)", name);
@@ -385,14 +473,24 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ramdisk=KB        Create a KB kB RAM disk named ram0.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -serial-lossy      Drop serial output rather than wait for room.\n"
+          "  -klog=LEVEL        Log messages up to LEVEL (default: debug).\n"
+          "  -klog-console=LEVEL  Print logged messages up to LEVEL\n"
+          "                     (default: info).\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -merge             Merge identical anonymous user pages.\n"
+          "  -rss-soft=COUNT    Prefer evicting from processes over COUNT pages.\n"
+          "  -rss-hard=COUNT    Keep each process to at most COUNT pages.\n"
 #endif
           );
   shutdown_power_off ();
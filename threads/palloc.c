@@ -9,6 +9,7 @@
 #include <string.h>
 #include "threads/loader.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* Page allocator.  Hands out memory in page-size (or
@@ -23,22 +24,40 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   While the CPU has nothing else to do, the idle thread zeroes
+   free pages ahead of time.  A zeroed page stays marked used in
+   its pool's used_map and is marked in zero_map instead, so that
+   PAL_ZERO requests for single pages can take it without paying
+   for a memset.  Other requests only fall back to zeroed pages
+   when the pool has run dry. */
 
 /* A memory pool. */
 struct pool
   {
     struct lock lock;                   /* Mutual exclusion. */
     struct bitmap *used_map;            /* Bitmap of free pages. */
+    struct bitmap *zero_map;            /* Bitmap of zeroed free pages. */
+    size_t zero_cnt;                    /* # of pages set in zero_map. */
+    size_t zero_max;                    /* Most pages to keep zeroed. */
     uint8_t *base;                      /* Base of pool. */
   };
 
 /* Two pools: one for kernel data, one for user pages. */
 static struct pool kernel_pool, user_pool;
 
+/* Statistics. */
+static long long zero_hits;     /* PAL_ZERO pages served pre-zeroed. */
+static long long zero_misses;   /* PAL_ZERO pages zeroed on demand. */
+static long long idle_zeroed;   /* Pages zeroed by the idle thread. */
+
 static void init_pool (struct pool *, void *base, size_t page_cnt,
                        const char *name);
 static bool page_from_pool (const struct pool *, void *page);
+static size_t take_zeroed_page (struct pool *);
+static void release_zeroed_pages (struct pool *);
+static bool pool_zero_page (struct pool *);
 
 /* Initializes the page allocator.  At most USER_PAGE_LIMIT
    pages are put into the user pool. */
@@ -73,12 +92,26 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
   void *pages;
   size_t page_idx;
+  bool zeroed = false;
 
   if (page_cnt == 0)
     return NULL;
 
   lock_acquire (&pool->lock);
-  page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  page_idx = BITMAP_ERROR;
+  if ((flags & PAL_ZERO) && page_cnt == 1)
+    {
+      page_idx = take_zeroed_page (pool);
+      zeroed = page_idx != BITMAP_ERROR;
+    }
+  if (page_idx == BITMAP_ERROR)
+    page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+  if (page_idx == BITMAP_ERROR && pool->zero_cnt > 0)
+    {
+      /* Out of plain free pages: give the zeroed ones back. */
+      release_zeroed_pages (pool);
+      page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+    }
   lock_release (&pool->lock);
 
   if (page_idx != BITMAP_ERROR)
@@ -89,7 +122,15 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt)
   if (pages != NULL) 
     {
       if (flags & PAL_ZERO)
-        memset (pages, 0, PGSIZE * page_cnt);
+        {
+          if (zeroed)
+            zero_hits++;
+          else
+            {
+              memset (pages, 0, PGSIZE * page_cnt);
+              zero_misses += page_cnt;
+            }
+        }
     }
   else 
     {
@@ -148,15 +189,35 @@ palloc_free_page (void *page)
   palloc_free_multiple (page, 1);
 }
 
+/* Zeroes one free page, if there is one and the pools want
+   more.  Returns true if a page was zeroed.  Called only by the
+   idle thread, which must never block. */
+bool
+palloc_zero_idle_page (void) 
+{
+  return pool_zero_page (&user_pool) || pool_zero_page (&kernel_pool);
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) 
+{
+  printf ("Palloc: %lld zeroed pages ready, %lld served, %lld zeroed on demand,"
+          " %lld zeroed while idle\n",
+          (long long) (user_pool.zero_cnt + kernel_pool.zero_cnt),
+          zero_hits, zero_misses, idle_zeroed);
+}
+
 /* Initializes pool P as starting at START and ending at END,
    naming it NAME for debugging purposes. */
 static void
 init_pool (struct pool *p, void *base, size_t page_cnt, const char *name) 
 {
-  /* We'll put the pool's used_map at its base.
-     Calculate the space needed for the bitmap
+  /* We'll put the pool's used_map and zero_map at its base.
+     Calculate the space needed for the bitmaps
      and subtract it from the pool's size. */
-  size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (page_cnt), PGSIZE);
+  size_t bm_size = bitmap_buf_size (page_cnt);
+  size_t bm_pages = DIV_ROUND_UP (2 * bm_size, PGSIZE);
   if (bm_pages > page_cnt)
     PANIC ("Not enough memory in %s for bitmap.", name);
   page_cnt -= bm_pages;
@@ -165,10 +226,76 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 
   /* Initialize the pool. */
   lock_init (&p->lock);
-  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
+  p->used_map = bitmap_create_in_buf (page_cnt, base, bm_size);
+  p->zero_map = bitmap_create_in_buf (page_cnt, (uint8_t *) base + bm_size,
+                                      bm_size);
+  p->zero_cnt = 0;
+  p->zero_max = page_cnt / 8;
   p->base = base + bm_pages * PGSIZE;
 }
 
+/* Takes a zeroed page out of POOL and returns its index, or
+   BITMAP_ERROR if there is none.  The page is already marked
+   used.  POOL's lock must be held. */
+static size_t
+take_zeroed_page (struct pool *pool) 
+{
+  size_t page_idx;
+
+  if (pool->zero_cnt == 0)
+    return BITMAP_ERROR;
+
+  page_idx = bitmap_scan_and_flip (pool->zero_map, 0, 1, true);
+  if (page_idx != BITMAP_ERROR)
+    pool->zero_cnt--;
+  return page_idx;
+}
+
+/* Marks all of POOL's zeroed pages free again.  POOL's lock must
+   be held. */
+static void
+release_zeroed_pages (struct pool *pool) 
+{
+  size_t page_idx;
+
+  while ((page_idx = take_zeroed_page (pool)) != BITMAP_ERROR)
+    bitmap_reset (pool->used_map, page_idx);
+}
+
+/* Zeroes one free page of POOL and adds it to the pool's zeroed
+   pages, unless it already has enough of them.  Returns true if
+   a page was zeroed.
+
+   The idle thread only runs when every other thread is blocked,
+   and no thread blocks while holding a pool lock, so the locks
+   are normally free here.  If the idle thread was preempted while
+   holding one, the holder of the other may be waiting for it:
+   yield until the lock can be taken instead of blocking. */
+static bool
+pool_zero_page (struct pool *pool) 
+{
+  size_t page_idx;
+
+  if (pool->zero_cnt >= pool->zero_max || !lock_try_acquire (&pool->lock))
+    return false;
+  page_idx = bitmap_scan_and_flip (pool->used_map, 0, 1, false);
+  lock_release (&pool->lock);
+  if (page_idx == BITMAP_ERROR)
+    return false;
+
+  /* The page is marked used, so nobody else touches it. */
+  memset (pool->base + PGSIZE * page_idx, 0, PGSIZE);
+
+  while (!lock_try_acquire (&pool->lock))
+    thread_yield ();
+  bitmap_mark (pool->zero_map, page_idx);
+  pool->zero_cnt++;
+  lock_release (&pool->lock);
+
+  idle_zeroed++;
+  return true;
+}
+
 /* Returns true if PAGE was allocated from POOL,
    false otherwise. */
 static bool
@@ -423,6 +423,20 @@ idle (void *idle_started_ UNUSED)
       intr_disable ();
       thread_block ();
 
+      /* Nothing else is ready: zero free pages for later PAL_ZERO
+         allocations, a page at a time, until some thread becomes
+         ready or the pools have enough. */
+      intr_enable ();
+      while (list_empty (&ready_list) && palloc_zero_idle_page ())
+        continue;
+      intr_disable ();
+
+      /* An interrupt handler may have readied a thread while we
+         were zeroing, without yielding to it.  Run it now rather
+         than at the next timer tick. */
+      if (!list_empty (&ready_list))
+        continue;
+
       /* Re-enable interrupts and wait for the next one.
 
          The `sti' instruction disables interrupts until the
@@ -121,6 +121,20 @@ struct thread
     
     void *esp;
     bool in_syscall;
+
+    /* Resident set, owned by vm/frame.c. */
+    size_t rss;                         /* Frames held. */
+    size_t rss_peak;                    /* Most frames ever held. */
+    size_t ws_refs;                     /* Frames seen referenced this sweep. */
+    size_t ws_size;                     /* Frames referenced last sweep. */
+    unsigned ws_sweep;                  /* Sweep that ws_refs belongs to. */
+    unsigned page_faults;               /* Pages brought in on faults. */
+    unsigned pages_evicted;             /* Frames taken by eviction. */
+#endif
+
+#ifdef FILESYS
+    /* Owned by filesys/journal.c. */
+    int journal_depth;                  /* Nesting of journal_begin(). */
 #endif
 
     /* Owned by thread.c. */
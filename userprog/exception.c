@@ -1,5 +1,6 @@
 #include "userprog/exception.h"
 #include <inttypes.h>
+#include <klog.h>
 #include <stdio.h>
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
@@ -9,6 +10,7 @@
 #include "userprog/process.h"
 #ifdef VM
 #include "vm/page.h"
+#include "vm/merge.h"
 #endif
 
 
@@ -158,8 +160,7 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  if (cur->tid == 3)
-    printf("pf....fault_addr 0x%x\n", fault_addr);
+  klog(KLOG_DEBUG, "pf....%s fault_addr %p", cur->name, fault_addr);
   if (!cur->in_syscall)
   {
 //    printf("not in syscall\n");
@@ -174,12 +175,20 @@ page_fault (struct intr_frame *f)
   }
   if (not_present)
   {
+#ifdef VM
+    cur->page_faults++;
+#endif
     if (!lazy_loading(cur, fault_addr))
     {
-      printf("lazy load error in page fault....0x%x\n", fault_addr);
+      klog(KLOG_DEBUG, "lazy load error in page fault....%p", fault_addr);
       goto bad_pf;
     }
   }
+#ifdef VM
+  /* Writing a merged page gives the writer its own copy */
+  else if (write && merge_break_cow(cur, pg_round_down(fault_addr)))
+    return;
+#endif
 
   return ;
   /* To implement virtual memory, delete the rest of the function
@@ -212,7 +221,7 @@ lazy_loading(struct thread *t, void *fault_addr)
       && is_stack_access(t, fault_addr) 
       && sg->type != SWAP)
   {
-    printf("check stack grow success\n");
+    klog(KLOG_DEBUG, "check stack grow success");
     sg = new_spt_entry(NULL, vaddr, 0, 0, 0, true, ZERO);
   }
 
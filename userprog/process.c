@@ -274,7 +274,6 @@ process_exit (void)
   }
   free(cur->fd);
 
-  destory_spt_table(cur);
   /* ### Sema up the parent which is waiting on this child process */
   if (!list_empty(&(thread_current()->wait_sema.waiters)))
   {
@@ -293,11 +292,20 @@ process_exit (void)
          process page directory.  We must activate the base page
          directory before destroying the process's page
          directory, or our active page directory will be one
-         that's been freed (and cleared). */
+         that's been freed (and cleared).  The eviction and
+         merge scans look at PTEs through the owners of frames
+         with the frame table lock held, so they see either the
+         whole table or none of it. */
+      lock_acquire (&frame_table_lock);
       cur->pagedir = NULL;
+      lock_release (&frame_table_lock);
       pagedir_activate (NULL);
       pagedir_destroy (pd);
     }
+
+  /* Only after our frames have left the frame table, so that the
+     eviction and merge scans never look up a destroyed table. */
+  destory_spt_table(cur);
 }
 
 /* Sets up the CPU for running user code in the current
@@ -308,8 +316,11 @@ process_activate (void)
 {
   struct thread *t = thread_current ();
 
-  /* Activate thread's page tables. */
-  pagedir_activate (t->pagedir);
+  /* Activate thread's page tables.  Kernel threads only touch
+     kernel memory, which every page directory maps the same way,
+     so they keep running on whichever one is loaded. */
+  if (t->pagedir != NULL)
+    pagedir_activate (t->pagedir);
 
   /* Set thread's kernel stack for use in processing
      interrupts. */
@@ -1,6 +1,12 @@
 #include "userprog/syscall.h"
-#include "devices/input.h"
+#include "devices/block.h"
+#include "devices/timer.h"
+#include "devices/tty.h"
 #include <stdio.h>
+#include <string.h>
+#include <blkstat.h>
+#include <dmesg.h>
+#include <klog.h>
 #include <syscall-nr.h>
 #include <console.h>
 #include "threads/interrupt.h"
@@ -38,6 +44,9 @@ static int _do_sys_write(int fd, void *buffer, unsigned size);
 static void _do_sys_seek(int fd, unsigned position);
 static mapid_t _do_sys_mmap(int fd, void *addr);
 static void _do_sys_munmap(mapid_t mapping);
+static bool _do_sys_memstat(struct memstat *ms);
+static bool _do_sys_blkstat(struct blkstat *st);
+static int _do_sys_dmesg(char *buffer, unsigned size);
 
 static bool _page_align_map(struct thread *t, void *addr)
 {
@@ -65,6 +74,23 @@ static bool _valid_uaddr(void *uaddr)
   else
     return true;
 }
+/* Check out whether every page of the SIZE bytes at user virtual
+   address BUFFER is a valid user virtual address */
+static bool _valid_ubuf(void *buffer, unsigned size)
+{
+  char *p = buffer;
+  char *end = p + size;
+
+  if (size == 0)
+    return true;
+  if (end < p)
+    return false;
+  for (; p < end; p = (char *)pg_round_down(p) + PGSIZE)
+    if (!_valid_uaddr(p))
+      return false;
+
+  return _valid_uaddr(end - 1);
+}
 /* Reads a byte at user virtual address UADDAR.
  * UADDAR must be below PHYS_BASE, Return the 
  * byte value if successful, -1 if a segfault occurred*/
@@ -175,6 +201,50 @@ syscall_handler (struct intr_frame *f)
       _do_sys_munmap(*(mapid_t *)(esp + 1));
       break;
 
+    case SYS_MEMSTAT:
+      if (!_valid_uaddr((void *)(*(esp + 1)))
+          || !_valid_uaddr((char *)(*(esp + 1)) + sizeof(struct memstat) - 1))
+        goto done;
+      f->eax = _do_sys_memstat((struct memstat *)(*(esp + 1)));
+      break;
+
+    case SYS_BLKSTAT:
+      if (!_valid_uaddr((void *)(*(esp + 1)))
+          || !_valid_uaddr((char *)(*(esp + 1))
+                           + BLKSTAT_CLASS_CNT * sizeof(struct blkstat) - 1))
+        goto done;
+      f->eax = _do_sys_blkstat((struct blkstat *)(*(esp + 1)));
+      break;
+
+    case SYS_DMESG:
+    {
+      struct dmesg_args *uargs = (struct dmesg_args *)(*(esp + 1));
+      struct dmesg_args args;
+
+      /* Read the arguments once, so another thread cannot change
+         them between the check and the copy */
+      if (!_valid_ubuf(uargs, sizeof *uargs))
+        goto done;
+      args = *uargs;
+      if (args.size > KLOG_SIZE)
+        args.size = KLOG_SIZE;
+      if (!_valid_ubuf(args.buffer, args.size))
+        goto done;
+      f->eax = _do_sys_dmesg(args.buffer, args.size);
+      break;
+    }
+
+    case SYS_TTYMODE:
+      f->eax = tty_set_mode(*(int *)(esp + 1));
+      break;
+
+    case SYS_CLOCK:
+      if (!_valid_uaddr((void *)(*(esp + 1)))
+          || !_valid_uaddr((char *)(*(esp + 1)) + sizeof(int64_t) - 1))
+        goto done;
+      *(int64_t *)(*(esp + 1)) = timer_ns();
+      break;
+
     default:
       goto done;
   }
@@ -290,11 +360,7 @@ static int _do_sys_read(int fd, void *buffer, unsigned size)
     return 0;
 
   if (fd == 0)
-  {
-    *buffers = input_getc();
-    buffers++;
-    read_size++;
-  }
+    read_size = tty_read(buffers, size);
   else 
   {
     f = (struct file *)(cur->fd)[fd];
@@ -428,11 +494,69 @@ static void _do_sys_munmap(mapid_t mapping)
   return;
 }
 
+/* Copies the memory usage of the current process into MS */
+static bool _do_sys_memstat(struct memstat *ms)
+{
+  struct memstat kms;
+
+  frame_memstat(thread_current(), &kms);
+  *ms = kms;
+
+  return true;
+}
+
+/* Copies the block I/O statistics of each class into ST, which
+   has BLKSTAT_CLASS_CNT elements. The copy is gathered on the
+   heap, since it is too large for the kernel stack */
+static bool _do_sys_blkstat(struct blkstat *st)
+{
+  struct blkstat *kst = malloc(BLKSTAT_CLASS_CNT * sizeof *kst);
+
+  if (kst == NULL)
+    return false;
+  block_get_stats(kst);
+  memcpy(st, kst, BLKSTAT_CLASS_CNT * sizeof *kst);
+  free(kst);
+
+  return true;
+}
+
+/* Copies the most recent kernel log lines, up to SIZE bytes, into
+   BUFFER and returns the number of bytes copied, or -1 if out of
+   memory. The log is copied out with interrupts off, so it goes
+   through the heap rather than straight to user memory, which may
+   fault */
+static int _do_sys_dmesg(char *buffer, unsigned size)
+{
+  char *kbuf;
+  size_t len;
+
+  if (size > KLOG_SIZE)
+    size = KLOG_SIZE;
+  kbuf = malloc(size > 0 ? size : 1);
+  if (kbuf == NULL)
+    return -1;
+  len = klog_read(kbuf, size);
+  memcpy(buffer, kbuf, len);
+  free(kbuf);
+
+  return len;
+}
+
 static void unmap(struct thread *t, struct spt_file *sf)
 {
-  void *kpage = pagedir_get_page(t->pagedir, sf->vaddr);
+  void *kpage;
+
+  /* A page cache frame is written back by the cache */
+  if (frame_unmap_cached(t, t->pagedir, sf->vaddr))
+  {
+    hash_delete(&t->spt_table, &sf->spt_hash_elem);
+    free(sf);
+    return;
+  }
 
   /* In this case, just return */
+  kpage = pagedir_get_page(t->pagedir, sf->vaddr);
   if (kpage == NULL)
     return;
 
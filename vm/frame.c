@@ -1,28 +1,45 @@
 #include "vm/frame.h"
+#include <klog.h>
+#include <string.h>
 #include "threads/synch.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "userprog/pagedir.h"
 #include "vm/swap.h"
+#include "vm/merge.h"
+#include "vm/pagecache.h"
 
 static struct list_elem *evict_pointer;
 /* Protect the frame table */
-static struct lock frame_table_lock;
+struct lock frame_table_lock;
 /* Frame hash table */
-static struct list frame_list_table;
+struct list frame_list_table;
 static int alloc_counts = 0;
+/* Full turns of the clock hand, used to age working set samples */
+static unsigned clock_sweep;
 
-static inline void update_frame_table(void *vir, void *p);
+/* Resident set limits in frames, 0 for none.  A process above its
+ * soft limit is evicted from first, a process at its hard limit
+ * must give up one of its own frames to get another. */
+size_t frame_rss_soft;
+size_t frame_rss_hard;
+
+static inline struct frame *update_frame_table(void *vir, void *p);
+static struct frame *pick_victim(struct thread *only);
+static void *take_free_page(enum palloc_flags flag);
+static void unlink_frame(struct frame *f);
+static void unmap_cached(struct frame *f, uint32_t *pd);
 
 void frame_table_init(void)
 {
   list_init(&frame_list_table);
   lock_init(&frame_table_lock);
   evict_pointer = list_head(&frame_list_table);
-  printf("frame table initialize...\n");
+  klog(KLOG_DEBUG, "frame table initialize...");
 }
 
-static inline void update_frame_table(void *vir, void *p)
+static inline struct frame *update_frame_table(void *vir, void *p)
 {
   struct thread *cur = thread_current();
   struct frame *f = (struct frame *)malloc(sizeof(struct frame));
@@ -30,23 +47,48 @@ static inline void update_frame_table(void *vir, void *p)
   f->pining = false;
   f->uvir = vir;
   f->kvir = p;
-  f->owner = cur;
+  f->owner = NULL;
+  frame_set_owner(f, cur);
+  f->share_cnt = 0;
+  f->checksum = 0;
+  f->merge_hash = NULL;
+  f->cached = false;
   list_push_back(&frame_list_table, &f->frame_list_elem);
+  return f;
 }
 
 void *frame_get_page(enum palloc_flags flag, void *vir)
 {
+  struct thread *cur = thread_current();
   void *p = NULL;
 
   if (!flag)
     return p;
 
   lock_acquire(&frame_table_lock);
-  p = palloc_get_page(flag);
+  /* At the hard limit, recycle one of our own frames.  If none
+   * can go, the allocation fails rather than exceed the limit. */
+  if (frame_rss_hard != 0 && cur->rss >= frame_rss_hard)
+  {
+    p = evict_frame(cur);
+    if (p == NULL && cur->rss >= frame_rss_hard)
+    {
+      lock_release(&frame_table_lock);
+      return NULL;
+    }
+  }
+  if (p == NULL)
+    p = take_free_page(flag);
+  else if (flag & PAL_ZERO)
+    memset(p, 0, PGSIZE);
   if (p == NULL)
   {
-    printf("alloc_counts %d no memory, should evict...\n", alloc_counts);
-    p = evict_frame(vir);
+    klog(KLOG_DEBUG, "alloc_counts %d no memory, should evict...",
+        alloc_counts);
+    p = evict_frame(NULL);
+    /* A recycled frame still holds its last owner's data */
+    if (p != NULL && (flag & PAL_ZERO))
+      memset(p, 0, PGSIZE);
   }
   if (!p)
     PANIC("user memory");
@@ -59,30 +101,193 @@ void *frame_get_page(enum palloc_flags flag, void *vir)
 void frame_free_page(void *kpage)
 {
   struct frame *f;
-  struct list_elem *e;
 
   if (kpage == NULL)
     return;
 
+  lock_acquire(&frame_table_lock);
+  f = frame_lookup(kpage);
+  if (f != NULL)
+  {
+    /* A merged frame stays until its last mapping goes away */
+    if (f->share_cnt > 1)
+      merge_drop_mapping(f);
+    else
+      frame_remove(f);
+  }
+  else
+    alloc_counts -= 1;
+  lock_release(&frame_table_lock);
+
+  return;
+}
+
+/* Makes room for T to take over one more frame without going
+ * above the hard limit, evicting one of T's own frames if T is at
+ * it.  Returns false if T is at the limit and none of its frames
+ * can go.  The frame table lock must be held. */
+bool frame_rss_reserve(struct thread *t)
+{
+  void *p;
+
+  ASSERT(lock_held_by_current_thread(&frame_table_lock));
+
+  if (frame_rss_hard == 0 || t->rss < frame_rss_hard)
+    return true;
+  p = evict_frame(t);
+  if (p == NULL)
+    return t->rss < frame_rss_hard;
+  palloc_free_page(p);
+  return true;
+}
+
+/* Takes a page from the user pool, taking back clean page cache
+ * frames while it is empty.  Returns NULL if there is none.  The
+ * frame table lock must be held. */
+static void *take_free_page(enum palloc_flags flag)
+{
+  void *p = palloc_get_page(flag);
+
+  /* Clean page cache frames are cheaper to take than to evict */
+  while (p == NULL && pagecache_reclaim())
+  {
+    alloc_counts -= 1;
+    p = palloc_get_page(flag);
+  }
+  return p;
+}
+
+/* Returns a free frame for the page cache, or NULL if free memory
+ * has run out, in which case the cache reuses one of its own
+ * frames instead.  Cache frames count as allocated, but are in the
+ * frame table only while mapped. */
+void *frame_get_cache_page(void)
+{
+  void *p;
+
+  lock_acquire(&frame_table_lock);
+  p = palloc_get_page(PAL_USER);
+  if (p != NULL)
+    alloc_counts += 1;
+  lock_release(&frame_table_lock);
+
+  return p;
+}
+
+/* Gives page cache frame KPAGE back to the user pool */
+void frame_free_cache_page(void *kpage)
+{
+  lock_acquire(&frame_table_lock);
+  palloc_free_page(kpage);
+  alloc_counts -= 1;
+  lock_release(&frame_table_lock);
+}
+
+/* Maps page cache frame KPAGE, which pagecache_map() returned, at
+ * UPAGE of the current process, and enters the mapping into the
+ * frame table, so that it counts towards the process's resident
+ * set and may be evicted.  On failure, at the hard limit or out of
+ * memory, the cache mapping is dropped and false returned. */
+bool frame_map_cached(void *kpage, void *upage, bool writable)
+{
+  struct thread *cur = thread_current();
+  bool success;
+
+  lock_acquire(&frame_table_lock);
+  success = frame_rss_reserve(cur)
+    && pagedir_set_page(cur->pagedir, upage, kpage, writable);
+  if (success)
+    update_frame_table(upage, kpage)->cached = true;
+  else if (pagecache_unmap(kpage, false))
+    alloc_counts -= 1;
+  lock_release(&frame_table_lock);
+
+  return success;
+}
+
+/* Unmaps UPAGE of T from page directory PD if it maps a page cache
+ * frame, handing the dirty bit to the cache.  Returns false if it
+ * does not. */
+bool frame_unmap_cached(struct thread *t, uint32_t *pd, void *upage)
+{
+  struct list_elem *e;
+  bool found = false;
+
   lock_acquire(&frame_table_lock);
   for (e = list_begin(&frame_list_table); e != list_end(&frame_list_table);
       e = list_next(e))
   {
-    f = list_entry(e, struct frame, frame_list_elem);
-    if (f->kvir == kpage)
+    struct frame *f = list_entry(e, struct frame, frame_list_elem);
+    if (f->cached && f->owner == t && f->uvir == upage)
     {
-      list_remove(e);
-      free(f);
-      palloc_free_page(kpage);
+      unmap_cached(f, pd);
+      found = true;
       break;
     }
   }
-  alloc_counts -= 1;
   lock_release(&frame_table_lock);
 
-  return;
+  return found;
+}
+
+/* Clears the mapping F stands for from PD, drops F and gives the
+ * mapping back to the page cache.  The frame table lock must be
+ * held. */
+static void unmap_cached(struct frame *f, uint32_t *pd)
+{
+  void *kpage = f->kvir;
+  bool dirty = pagedir_is_dirty(pd, f->uvir);
+
+  pagedir_clear_page(pd, f->uvir);
+  unlink_frame(f);
+  if (pagecache_unmap(kpage, dirty))
+    alloc_counts -= 1;
+}
+
+/* Returns the private or merged frame whose kernel virtual
+ * address is KPAGE, or NULL.  Mappings of page cache frames, of
+ * which there may be several per frame, are not looked up.  The
+ * frame table lock must be held. */
+struct frame *frame_lookup(void *kpage)
+{
+  struct list_elem *e;
+
+  ASSERT(lock_held_by_current_thread(&frame_table_lock));
+
+  for (e = list_begin(&frame_list_table); e != list_end(&frame_list_table);
+      e = list_next(e))
+  {
+    struct frame *f = list_entry(e, struct frame, frame_list_elem);
+    if (f->kvir == kpage && !f->cached)
+      return f;
+  }
+
+  return NULL;
+}
+
+/* Removes F from the frame table and gives its page back to the
+ * user pool.  The frame table lock must be held. */
+void frame_remove(struct frame *f)
+{
+  ASSERT(lock_held_by_current_thread(&frame_table_lock));
+
+  palloc_free_page(f->kvir);
+  unlink_frame(f);
+  alloc_counts -= 1;
 }
 
+/* Takes F out of the frame table and frees it, leaving its page
+ * alone.  The frame table lock must be held. */
+static void unlink_frame(struct frame *f)
+{
+  if (evict_pointer == &f->frame_list_elem)
+    evict_pointer = list_prev(evict_pointer);
+  if (f->merge_hash != NULL)
+    hash_delete(f->merge_hash, &f->merge_elem);
+  list_remove(&f->frame_list_elem);
+  frame_set_owner(f, NULL);
+  free(f);
+}
 
 void debug_frame_table(void)
 {
@@ -97,16 +302,78 @@ void debug_frame_table(void)
       e = list_next(e))
   {
     struct frame *f = list_entry(e, struct frame, frame_list_elem);
-    printf("Vir 0x%-10x to p 0x%-10x, Owner[%s]\n", f->uvir, f->kvir, f->owner->name);
+    if (f->share_cnt > 0)
+      printf("Merged p 0x%-10x, %d mappings\n", f->kvir, f->share_cnt);
+    else
+      printf("Vir 0x%-10x to p 0x%-10x, Owner[%s]\n", f->uvir, f->kvir, f->owner->name);
   }
   lock_release(&frame_table_lock);
 }
 
+/* Hands F over to T, or to nobody if T is NULL, and moves it
+ * between their resident sets.  The frame table lock must be
+ * held, or F must not be in the frame table yet. */
+void frame_set_owner(struct frame *f, struct thread *t)
+{
+  if (f->owner != NULL)
+    f->owner->rss--;
+  f->owner = t;
+  if (t != NULL && ++t->rss > t->rss_peak)
+    t->rss_peak = t->rss;
+}
+
+/* Starts a new working set sample for T if the clock hand went
+ * round since its last one.  A sample older than the last sweep
+ * means T referenced nothing the hand saw. */
+static void ws_update(struct thread *t)
+{
+  if (t->ws_sweep == clock_sweep)
+    return;
+  t->ws_size = t->ws_sweep + 1 == clock_sweep ? t->ws_refs : 0;
+  t->ws_refs = 0;
+  t->ws_sweep = clock_sweep;
+}
+
+/* Returns the working set estimate of T: the frames of T that
+ * the clock hand found referenced during its last full sweep, or
+ * during the current one if that is more. */
+static size_t ws_estimate(struct thread *t)
+{
+  ws_update(t);
+  return t->ws_refs > t->ws_size ? t->ws_refs : t->ws_size;
+}
+
+/* A process holds more than its target if it is above the soft
+ * limit or, without one, above its working set estimate. */
+static bool rss_over_target(struct thread *t)
+{
+  size_t target = frame_rss_soft != 0 ? frame_rss_soft : ws_estimate(t);
+
+  return t->rss > target;
+}
+
+/* Fills MS with the memory usage of T */
+void frame_memstat(struct thread *t, struct memstat *ms)
+{
+  lock_acquire(&frame_table_lock);
+  ms->rss = t->rss;
+  ms->rss_peak = t->rss_peak;
+  ms->ws = ws_estimate(t);
+  ms->rss_soft = frame_rss_soft;
+  ms->rss_hard = frame_rss_hard;
+  ms->page_faults = t->page_faults;
+  ms->pages_evicted = t->pages_evicted;
+  lock_release(&frame_table_lock);
+}
+
 /* #### evict policy */
 static struct list_elem *evict_pointer_next(struct list_elem *e)
 {
   if (list_next(e) == list_tail(&frame_list_table))
+  {
+    clock_sweep++;
     return list_next(list_head(&frame_list_table));
+  }
 
   return list_next(e);
 }
@@ -114,6 +381,11 @@ static struct list_elem *evict_pointer_next(struct list_elem *e)
 #define frame_is_accessed(f) pagedir_is_accessed(f->owner->pagedir, f->uvir)
 #define frame_is_writed(f) pagedir_is_dirty(f->owner->pagedir, f->uvir)
 #define frame_set_not_accessed(f) pagedir_set_accessed(f->owner->pagedir, f->uvir, false)
+/* Merged frames have no single owner and pinned frames must stay.
+ * Frames of an exiting process that already dropped its page
+ * directory are on their way out anyway. */
+#define frame_is_evictable(f) (!(f)->pining && (f)->share_cnt == 0 \
+    && (f)->owner != NULL && (f)->owner->pagedir != NULL)
 //static bool frame_is_accessed(struct frame *f)
 //{
 //  return pagedir_is_accessed(f->owner->pagedir, f->uvir);
@@ -122,7 +394,64 @@ static struct list_elem *evict_pointer_next(struct list_elem *e)
 //{
 //  return pagedir_is_dirty(f->owner->pagedir, f->uvir);
 //}
-void *evict_frame(void *vir)
+/* Moves the clock hand to the frame to evict next and returns
+ * it.  Referenced frames get a second chance, and count towards
+ * their owner's working set.  For the first two turns only frames
+ * of ONLY, or if ONLY is NULL, of processes over their target
+ * qualify.  After that ONLY gets NULL back and everyone else any
+ * unreferenced frame. */
+static struct frame *pick_victim(struct thread *only)
+{
+  size_t limit = 2 * list_size(&frame_list_table);
+  size_t scanned;
+  struct frame *page;
+
+  for (scanned = 0; ; scanned++,
+      evict_pointer = evict_pointer_next(evict_pointer))
+  {
+    bool picky = scanned < limit;
+
+    if (!picky && only != NULL)
+      return NULL;
+    page = list_entry(evict_pointer, struct frame, frame_list_elem);
+    if (!frame_is_evictable(page))
+      continue;
+    if (frame_is_accessed(page))
+    {
+      frame_set_not_accessed(page);
+      ws_update(page->owner);
+      page->owner->ws_refs++;
+      continue;
+    }
+    if (only != NULL ? page->owner == only
+        : !picky || rss_over_target(page->owner))
+      return page;
+  }
+}
+
+/* Unmaps page cache frame mapping F, the clock hand's victim, from
+ * its owner, which faults it back in from the cache when needed */
+static void evict_cached(struct frame *f)
+{
+  struct thread *t = f->owner;
+  struct spt_file *sf;
+
+  sf = (struct spt_file *)find_lazy_page_spt_entry(t, f->uvir);
+  lock_acquire(&t->spt_table_lock);
+  if (sf != NULL)
+    sf->loaded = false;
+  evict_pointer = evict_pointer_next(evict_pointer);
+  unmap_cached(f, t->pagedir);
+  lock_release(&t->spt_table_lock);
+  t->pages_evicted++;
+}
+
+/* Evicts a frame, of ONLY if it is not NULL, and returns its
+ * kernel address for reuse.  Returns NULL if ONLY has no frame
+ * that can go, or if evicting page cache mappings of ONLY brought
+ * it below its hard limit without freeing a page.  The frame
+ * table lock must be held. */
+void *evict_frame(struct thread *only)
 {
   struct frame *page;
   struct spt_general *sg;
@@ -130,30 +459,40 @@ void *evict_frame(void *vir)
   struct list_elem *e;
   struct spt_file *sf;
 
-  if (evict_pointer == list_head(&frame_list_table))
-  {
-    printf("first evict...\n");
-    evict_pointer = evict_pointer_next(evict_pointer);
-  }
-  page = list_entry(evict_pointer, struct frame, frame_list_elem);
-  while(frame_is_accessed(page))
+  for (;;)
   {
-    frame_set_not_accessed(page);
+    if (evict_pointer == list_head(&frame_list_table))
+    {
+      if (list_empty(&frame_list_table))
+        return NULL;
+      klog(KLOG_DEBUG, "first evict...");
+      evict_pointer = evict_pointer_next(evict_pointer);
+    }
+    page = pick_victim(only);
+    if (page == NULL)
+      return NULL;
+    if (!page->cached)
+      break;
 
-    evict_pointer = evict_pointer_next(evict_pointer);
-    page = list_entry(evict_pointer, struct frame, frame_list_elem);
-  }/* find the page*/
+    /* Dropping a page cache mapping frees no page by itself, but
+     * may leave the cache frame clean and idle, to be taken back */
+    evict_cached(page);
+    kvir = take_free_page(PAL_USER);
+    if (kvir != NULL || only != NULL)
+      return kvir;
+  }
 
   if (!frame_is_accessed(page))
   {
-    printf("find a page to evict...0x%x %s id(%d)\n", page->uvir, page->owner->name, page->owner->tid);
+    klog(KLOG_DEBUG, "find a page to evict...%p %s id(%d)", page->uvir,
+        page->owner->name, page->owner->tid);
   }
   if (page == NULL)
-    printf("Opoos, it`s a kernel bug...\n");
+    klog(KLOG_ERR, "Opoos, it`s a kernel bug...");
   sg = find_lazy_page_spt_entry(page->owner, page->uvir);
   if (sg == NULL)
   {
-    printf("Opoos, it`s a bug...\n");
+    klog(KLOG_ERR, "Opoos, it`s a bug...");
   }
   lock_acquire(&page->owner->spt_table_lock);
   
@@ -167,13 +506,13 @@ void *evict_frame(void *vir)
       sf->loaded = false;
       break;
     case SWAP:
-      printf("it can`t be spt_swap_entry.\n");
+      klog(KLOG_ERR, "it can`t be spt_swap_entry.");
       break;
     case ZERO:
       ((struct spt_zero *)sg)->loaded = false;
       break;
     default:
-      printf("Opoos, it`s a bug...\n");
+      klog(KLOG_ERR, "Opoos, it`s a bug...");
   }
 //  if (frame_is_writed(page))
 //  {
@@ -198,11 +537,16 @@ void *evict_frame(void *vir)
   e = evict_pointer;
   evict_pointer = evict_pointer_next(evict_pointer);
   kvir = page->kvir;
+  if (page->merge_hash != NULL)
+    hash_delete(page->merge_hash, &page->merge_elem);
   list_remove(e);
   pagedir_clear_page(page->owner->pagedir, page->uvir);
   lock_release(&page->owner->spt_table_lock);
 
+  page->owner->pages_evicted++;
+  frame_set_owner(page, NULL);
   free(page);
+  alloc_counts -= 1;
   return kvir;
 
 swap_to_disk:
@@ -215,10 +559,15 @@ swap_to_disk:
   e = evict_pointer;
   evict_pointer = evict_pointer_next(evict_pointer);
   kvir = page->kvir;
+  if (page->merge_hash != NULL)
+    hash_delete(page->merge_hash, &page->merge_elem);
   list_remove(e);
   pagedir_clear_page(page->owner->pagedir, page->uvir);
   lock_release(&page->owner->spt_table_lock);
 
+  page->owner->pages_evicted++;
+  frame_set_owner(page, NULL);
   free(page);
+  alloc_counts -= 1;
   return kvir;
 }
@@ -2,7 +2,10 @@
 #define VM_FRAME_H
 
 #include <list.h>
+#include <hash.h>
+#include <memstat.h>
 #include "threads/palloc.h"
+#include "threads/synch.h"
 
 struct frame
 {
@@ -14,14 +17,40 @@ struct frame
   void *kvir;
   /* Which thread obtained this frame */
   struct thread *owner;
+  /* Number of mappings of a merged frame, 0 if private */
+  int share_cnt;
+  /* Contents checksum seen by the last merge scan */
+  unsigned checksum;
+  /* Mapping of a page cache frame, which the cache owns */
+  bool cached;
+  /* Merge table this frame is indexed in, or NULL */
+  struct hash *merge_hash;
+  struct hash_elem merge_elem;
   /* Hash element */
   struct list_elem frame_list_elem;
 };
 
+/* Frame table and its lock, shared with the merge daemon */
+extern struct list frame_list_table;
+extern struct lock frame_table_lock;
+
+/* -rss-soft and -rss-hard, in frames, 0 for no limit */
+extern size_t frame_rss_soft;
+extern size_t frame_rss_hard;
+
 /* Frame table function */
 void frame_table_init(void);
 void *frame_get_page(enum palloc_flags flag, void *vir);
 void frame_free_page(void *p);
-void *evict_frame(void *vir);
+struct frame *frame_lookup(void *kpage);
+void frame_remove(struct frame *f);
+void frame_set_owner(struct frame *f, struct thread *t);
+bool frame_rss_reserve(struct thread *t);
+void *frame_get_cache_page(void);
+void frame_free_cache_page(void *kpage);
+bool frame_map_cached(void *kpage, void *upage, bool writable);
+bool frame_unmap_cached(struct thread *t, uint32_t *pd, void *upage);
+void frame_memstat(struct thread *t, struct memstat *ms);
+void *evict_frame(struct thread *only);
 void debug_frame_table(void);
 #endif
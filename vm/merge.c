@@ -0,0 +1,322 @@
+#include "vm/merge.h"
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "userprog/pagedir.h"
+#include "vm/page.h"
+
+/* Same-page merging.  The merge daemon walks the frame table a
+ * batch at a time and checksums anonymous frames.  A frame whose
+ * checksum did not change since the last visit is stable and is
+ * looked up, first among the merged frames, then among the other
+ * stable candidates of this cycle.  Identical frames are folded
+ * into one frame mapped read-only by every owner; a write to it
+ * faults and merge_break_cow() hands the writer a private copy. */
+
+/* Ticks between two scan passes */
+#define MERGE_SCAN_INTERVAL (TIMER_FREQ / 2)
+/* Frames checksummed in one pass */
+#define MERGE_SCAN_BATCH 64
+
+bool merge_enabled;
+
+/* Merged frames, keyed by checksum */
+static struct hash stable_table;
+/* Stable private candidates of the current cycle, keyed by checksum */
+static struct hash unstable_table;
+/* Position of the next pass in the frame table */
+static size_t merge_cursor;
+
+/* Statistics */
+static long long pages_saved;   /* Frames given back by merging */
+static long long merge_cnt;     /* Pages folded into a merged frame */
+static long long cow_cnt;       /* Merged pages copied on write */
+static long long scan_passes;   /* Scan passes run */
+static long long scan_frames;   /* Frames checksummed */
+static long long scan_ticks;    /* Timer ticks spent scanning */
+
+static void merge_daemon(void *aux UNUSED);
+static void merge_scan(void);
+static void merge_scan_frame(struct frame *f);
+static bool merge_into(struct frame *f, struct frame *s);
+static bool merge_pair(struct frame *u, struct frame *f);
+static bool frame_is_mergeable(struct frame *f);
+static void unstable_clear_func(struct hash_elem *e, void *aux UNUSED);
+
+static unsigned merge_hash_func(const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_entry(e, struct frame, merge_elem)->checksum;
+}
+
+static bool merge_less_func(const struct hash_elem *a,
+                            const struct hash_elem *b,
+                            void *aux UNUSED)
+{
+  return hash_entry(a, struct frame, merge_elem)->checksum
+    < hash_entry(b, struct frame, merge_elem)->checksum;
+}
+
+/* Starts the merge daemon if -merge was given */
+void merge_init(void)
+{
+  if (!merge_enabled)
+    return;
+
+  hash_init(&stable_table, merge_hash_func, merge_less_func, NULL);
+  hash_init(&unstable_table, merge_hash_func, merge_less_func, NULL);
+  merge_cursor = 0;
+  thread_create("merged", PRI_DEFAULT, merge_daemon, NULL);
+}
+
+static void merge_daemon(void *aux UNUSED)
+{
+  for (;;)
+  {
+    timer_sleep(MERGE_SCAN_INTERVAL);
+    merge_scan();
+  }
+}
+
+/* Checksums the next MERGE_SCAN_BATCH frames of the frame table.
+ * When the walk wraps around, a new cycle begins and the unstable
+ * candidates of the last one are forgotten. */
+static void merge_scan(void)
+{
+  struct list_elem *e, *next;
+  int64_t start = timer_ticks();
+  size_t idx = 0;
+
+  lock_acquire(&frame_table_lock);
+  for (e = list_begin(&frame_list_table); e != list_end(&frame_list_table);
+      e = next, idx++)
+  {
+    next = list_next(e);
+    if (idx < merge_cursor)
+      continue;
+    if (idx >= merge_cursor + MERGE_SCAN_BATCH)
+      break;
+    merge_scan_frame(list_entry(e, struct frame, frame_list_elem));
+  }
+
+  if (e == list_end(&frame_list_table))
+  {
+    merge_cursor = 0;
+    hash_clear(&unstable_table, unstable_clear_func);
+  }
+  else
+    merge_cursor += MERGE_SCAN_BATCH;
+  lock_release(&frame_table_lock);
+
+  scan_passes++;
+  scan_ticks += timer_elapsed(start);
+}
+
+static void merge_scan_frame(struct frame *f)
+{
+  struct hash_elem *e;
+  unsigned checksum;
+
+  if (!frame_is_mergeable(f))
+    return;
+
+  scan_frames++;
+  checksum = hash_bytes(f->kvir, PGSIZE);
+  if (checksum != f->checksum)
+  {
+    /* Still changing, check again next cycle */
+    f->checksum = checksum;
+    if (f->merge_hash != NULL)
+    {
+      hash_delete(f->merge_hash, &f->merge_elem);
+      f->merge_hash = NULL;
+    }
+    return;
+  }
+  if (f->merge_hash != NULL)
+    return;
+
+  e = hash_find(&stable_table, &f->merge_elem);
+  if (e != NULL
+      && merge_into(f, hash_entry(e, struct frame, merge_elem)))
+    return;
+
+  e = hash_find(&unstable_table, &f->merge_elem);
+  if (e == NULL)
+  {
+    hash_insert(&unstable_table, &f->merge_elem);
+    f->merge_hash = &unstable_table;
+  }
+  else
+    merge_pair(hash_entry(e, struct frame, merge_elem), f);
+}
+
+/* Private anonymous frames of live processes are candidates.
+ * A process clears its page directory under the frame table lock
+ * on exit, so the check stays good while the lock is held. */
+static bool frame_is_mergeable(struct frame *f)
+{
+  struct spt_general *sg;
+
+  if (f->pining || f->share_cnt > 0 || f->cached || f->owner == NULL
+      || f->owner->pagedir == NULL)
+    return false;
+
+  sg = find_lazy_page_spt_entry(f->owner, f->uvir);
+  return sg != NULL && (sg->type == ZERO || sg->type == SWAP)
+    && spt_entry_writeable(sg);
+}
+
+/* Maps the page of private frame F onto merged frame S if both
+ * hold the same bytes, and releases F.  F's page is write
+ * protected before comparing so that it cannot change under us. */
+static bool merge_into(struct frame *f, struct frame *s)
+{
+  uint32_t *pd = f->owner->pagedir;
+  void *upage = f->uvir;
+
+  ASSERT(lock_held_by_current_thread(&frame_table_lock));
+  ASSERT(pd != NULL);
+  pagedir_set_writable(pd, upage, false);
+  if (memcmp(f->kvir, s->kvir, PGSIZE) != 0)
+  {
+    pagedir_set_writable(pd, upage, true);
+    return false;
+  }
+
+  pagedir_clear_page(pd, upage);
+  pagedir_set_page(pd, upage, s->kvir, false);
+  s->share_cnt++;
+  frame_remove(f);
+
+  pages_saved++;
+  merge_cnt++;
+  return true;
+}
+
+/* Turns unstable candidate U into a merged frame shared with F,
+ * if their contents match. */
+static bool merge_pair(struct frame *u, struct frame *f)
+{
+  uint32_t *pd;
+
+  ASSERT(u != f);
+
+  /* U was a candidate when an earlier pass saw it, but its owner
+   * may have started exiting since. */
+  hash_delete(&unstable_table, &u->merge_elem);
+  u->merge_hash = NULL;
+  if (u->owner == NULL || u->owner->pagedir == NULL)
+    return false;
+  pd = u->owner->pagedir;
+  pagedir_set_writable(pd, u->uvir, false);
+
+  if (memcmp(u->kvir, f->kvir, PGSIZE) != 0)
+  {
+    pagedir_set_writable(pd, u->uvir, true);
+    return false;
+  }
+
+  u->share_cnt = 1;
+  frame_set_owner(u, NULL);
+  u->uvir = NULL;
+  if (hash_insert(&stable_table, &u->merge_elem) == NULL)
+    u->merge_hash = &stable_table;
+  merge_cnt++;
+
+  return merge_into(f, u);
+}
+
+/* Gives up one mapping of merged frame F, which keeps at least
+ * one more.  The frame table lock must be held. */
+void merge_drop_mapping(struct frame *f)
+{
+  ASSERT(f->share_cnt > 1);
+
+  f->share_cnt--;
+  pages_saved--;
+}
+
+/* Handles a write fault on UPAGE of T.  If the page is a merged
+ * one that T may write, T gets it back writable, copying it first
+ * if other mappings remain.  Returns false if the fault was not
+ * caused by merging. */
+bool merge_break_cow(struct thread *t, void *upage)
+{
+  struct spt_general *sg;
+  struct frame *f;
+  void *kpage, *copy;
+
+  if (!merge_enabled || t->pagedir == NULL)
+    return false;
+
+  kpage = pagedir_get_page(t->pagedir, upage);
+  sg = find_lazy_page_spt_entry(t, upage);
+  if (kpage == NULL || sg == NULL || !spt_entry_writeable(sg))
+    return false;
+
+  lock_acquire(&frame_table_lock);
+  f = frame_lookup(kpage);
+  if (f == NULL)
+  {
+    lock_release(&frame_table_lock);
+    return false;
+  }
+  if (f->share_cnt <= 1)
+  {
+    /* Either protected by a scan that found no match, or the
+     * last mapping of a merged frame: take it over in place. */
+    if (f->share_cnt == 1)
+    {
+      /* Taking the frame over counts against T's hard limit */
+      if (!frame_rss_reserve(t))
+      {
+        lock_release(&frame_table_lock);
+        return false;
+      }
+      if (f->merge_hash != NULL)
+        hash_delete(f->merge_hash, &f->merge_elem);
+      f->merge_hash = NULL;
+      f->share_cnt = 0;
+      frame_set_owner(f, t);
+      f->uvir = upage;
+    }
+    pagedir_set_writable(t->pagedir, upage, true);
+    pagedir_set_dirty(t->pagedir, upage, true);
+    lock_release(&frame_table_lock);
+    return true;
+  }
+  lock_release(&frame_table_lock);
+
+  copy = frame_get_page(PAL_USER, upage);
+  if (copy == NULL)
+    return false;
+  memcpy(copy, kpage, PGSIZE);
+  pagedir_clear_page(t->pagedir, upage);
+  pagedir_set_page(t->pagedir, upage, copy, true);
+  /* There is no clean copy of this page anywhere else */
+  pagedir_set_dirty(t->pagedir, upage, true);
+  frame_free_page(kpage);
+  cow_cnt++;
+
+  return true;
+}
+
+static void unstable_clear_func(struct hash_elem *e, void *aux UNUSED)
+{
+  hash_entry(e, struct frame, merge_elem)->merge_hash = NULL;
+}
+
+/* Prints same-page merging statistics */
+void merge_print_stats(void)
+{
+  if (!merge_enabled)
+    return;
+
+  printf("Merge: %lld pages saved, %lld merged, %lld copied on write\n",
+      pages_saved, merge_cnt, cow_cnt);
+  printf("Merge: %lld passes, %lld frames scanned in %lld ticks\n",
+      scan_passes, scan_frames, scan_ticks);
+}
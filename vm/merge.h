@@ -0,0 +1,15 @@
+#ifndef VM_MERGE_H
+#define VM_MERGE_H
+
+#include <stdbool.h>
+#include "threads/thread.h"
+#include "vm/frame.h"
+
+/* -merge: run the same-page merging daemon? */
+extern bool merge_enabled;
+
+void merge_init(void);
+bool merge_break_cow(struct thread *t, void *upage);
+void merge_drop_mapping(struct frame *f);
+void merge_print_stats(void);
+#endif
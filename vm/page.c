@@ -1,5 +1,6 @@
 #include "vm/page.h"
 #include "vm/frame.h"
+#include "vm/pagecache.h"
 #include "vm/swap.h"
 #include "threads/vaddr.h"
 #include "threads/malloc.h"
@@ -149,6 +150,23 @@ struct spt_general *find_lazy_page_spt_entry(struct thread *t, uint32_t *vaddr)
     return hash_entry(e, struct spt_general, spt_hash_elem);
 }
 
+/* Whether the page described by SG may be written by its owner */
+bool spt_entry_writeable(struct spt_general *sg)
+{
+  switch (sg->type)
+  {
+    case MMF:
+    case FILE:
+      return ((struct spt_file *)sg)->writeable;
+    case ZERO:
+      return ((struct spt_zero *)sg)->writeable;
+    case SWAP:
+      return ((struct spt_swap *)sg)->writeable;
+    default:
+      return false;
+  }
+}
+
 /* laod a page */
 bool load_lazy_page_spt_entry(struct spt_general *sg)
 {
@@ -180,6 +198,8 @@ static bool load_swap_page(struct spt_general *sg)
   struct thread *t = thread_current();
   printf("%d load swap page...0x%x\n", t->tid, f);
 
+  if (f == NULL)
+    return false;
   status  = swap_out(ss->idx, f);
   if (!status)
     PANIC("swap out error");
@@ -192,17 +212,31 @@ static bool load_swap_page(struct spt_general *sg)
 static bool load_file_page(struct spt_general *sg)
 {
   struct spt_file *sf = sg;
-  void *f = frame_get_page(PAL_USER, sg->vaddr);
   struct thread *t = thread_current();
+  void *f;
+
+  /* A mapped file shares the page cache frame, so that read() and
+   * write() see the mapping and the other way round.  Without a
+   * cache frame, fall back to a private copy. */
+  if (sf->type == MMF && pagedir_get_page(t->pagedir, sf->vaddr) == NULL)
+  {
+    f = pagecache_map(file_get_inode(sf->file), sf->offset);
+    if (f != NULL && frame_map_cached(f, sf->vaddr, sf->writeable))
+    {
+      sf->loaded = true;
+      return true;
+    }
+  }
+
+  f = frame_get_page(PAL_USER, sg->vaddr);
 
   /* loading */
   file_seek(sf->file, sf->offset);
 //  printf("offset: %d read_bytes: %d zero_bytes: %d\n", 
 //      sf->offset, sf->read_bytes, sf->zero_bytes);
+  /* Only fails at the hard resident set limit */
   if (f == NULL)
-  {
-    PANIC("memory");
-  }
+    return false;
 //  if (sf->type == MMF)
 //    printf("sf->vaddr 0x%x read_bytes %d, zero_bytes%d\n ", 
 //        sf->vaddr, sf->read_bytes, sf->zero_bytes);
@@ -237,10 +271,9 @@ static bool load_zero_page(struct spt_general *sg)
 
 
   printf("load zero page...\n");
+  /* Only fails at the hard resident set limit */
   if (f == NULL)
-  {
-    PANIC("memory");
-  }
+    return false;
 
   if (pagedir_get_page(t->pagedir, sz->vaddr) != NULL)
   {
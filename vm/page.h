@@ -72,5 +72,6 @@ struct spt_general *new_spt_entry(struct file *f, void *uva, off_t offset,
 
 struct spt_general *find_lazy_page_spt_entry(struct thread *t, uint32_t *vaddr);
 bool load_lazy_page_spt_entry(struct spt_general *sg);
+bool spt_entry_writeable(struct spt_general *sg);
 struct spt_swap * new_swap_spt_entry(void *uva, size_t index);
 #endif
@@ -0,0 +1,552 @@
+#include "vm/pagecache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/frame.h"
+
+/* Page cache.  File data is cached in page sized frames, one per
+ * page of a file, shared by read(), write() and mmap().  Reads of
+ * regular files copy out of the cache, a write updates the cached
+ * page after writing the file, and a mmap fault maps the cached
+ * frame itself into the process, so that a page of a file is in
+ * memory at most once.
+ *
+ * A frame stays cached while it is mapped.  Changes made through
+ * mappings are noticed through the dirty bit when the page is
+ * unmapped, and reach the file when the page is written back:
+ * when it is reclaimed, when its inode goes away, or at shutdown.
+ * A mapped page counts as dirty for the latter two.
+ *
+ * Cached frames come from the frame layer, which counts them, up
+ * to PAGECACHE_MAX of them while free memory lasts.  When the frame
+ * allocator runs short it first takes back clean, unmapped cache
+ * pages.  Each mapping of a cached frame is in the frame table,
+ * where it counts towards the resident set of its process and can
+ * be evicted, which unmaps it.
+ *
+ * The frame table lock is taken before the cache lock, never
+ * after: the frame layer calls pagecache_unmap() and
+ * pagecache_reclaim() with it held, and the cache gets and frees
+ * frames with its own lock dropped.
+ *
+ * The cache lock is never held while copying to or from user
+ * memory, which may fault, while reading in or while writing back,
+ * which may wait for the disk or a journal commit.  A page is
+ * pinned meanwhile instead.  A page being read in is in the cache
+ * already, marked loading, and others wanting it wait until it is
+ * in, so that misses on different pages go to the disk at the
+ * same time. */
+
+/* Maximum number of cached pages */
+#define PAGECACHE_MAX 64
+
+struct cache_page
+{
+  /* Inode and page aligned offset of the data, inode NULL once
+   * orphaned by pagecache_drop() while still mapped */
+  struct inode *inode;
+  off_t offset;
+  /* Kernel virtual address of the frame */
+  void *kpage;
+  /* Number of user mappings */
+  int map_cnt;
+  /* Copies, write back or reading in in progress */
+  int pin_cnt;
+  /* Being read in, with the cache lock dropped */
+  bool loading;
+  /* Changed through a mapping since last written back */
+  bool dirty;
+  /* Last pagecache_flush() pass that wrote it back */
+  unsigned flush_pass;
+  /* Element in page_table, keyed by inode and offset */
+  struct hash_elem hash_elem;
+  /* Element in kpage_table, keyed by kpage */
+  struct hash_elem kpage_elem;
+  /* Element in lru, unless orphaned */
+  struct list_elem lru_elem;
+};
+
+static struct hash page_table;
+static struct hash kpage_table;
+/* Most recently used first */
+static struct list lru;
+static size_t page_cnt;
+static unsigned flush_pass;
+static struct lock cache_lock;
+/* Broadcast when a page has been read in */
+static struct condition page_loaded;
+
+/* Statistics */
+static long long hit_cnt;       /* Lookups found cached */
+static long long miss_cnt;      /* Pages read in */
+static long long writeback_cnt; /* Pages written back */
+static long long map_cnt;       /* Pages mapped by mmap faults */
+
+static struct cache_page *get_page(struct inode *inode, off_t offset);
+static struct cache_page *lookup(struct inode *inode, off_t offset);
+static void write_back(struct cache_page *p);
+static void *release_page(struct cache_page *p);
+
+static unsigned page_hash_func(const struct hash_elem *e, void *aux UNUSED)
+{
+  struct cache_page *p = hash_entry(e, struct cache_page, hash_elem);
+  return hash_bytes(&p->inode, sizeof p->inode) ^ hash_int(p->offset);
+}
+
+static bool page_less_func(const struct hash_elem *a_,
+                           const struct hash_elem *b_,
+                           void *aux UNUSED)
+{
+  struct cache_page *a = hash_entry(a_, struct cache_page, hash_elem);
+  struct cache_page *b = hash_entry(b_, struct cache_page, hash_elem);
+
+  if (a->inode != b->inode)
+    return a->inode < b->inode;
+  return a->offset < b->offset;
+}
+
+static unsigned kpage_hash_func(const struct hash_elem *e, void *aux UNUSED)
+{
+  struct cache_page *p = hash_entry(e, struct cache_page, kpage_elem);
+  return hash_bytes(&p->kpage, sizeof p->kpage);
+}
+
+static bool kpage_less_func(const struct hash_elem *a,
+                            const struct hash_elem *b,
+                            void *aux UNUSED)
+{
+  return hash_entry(a, struct cache_page, kpage_elem)->kpage
+    < hash_entry(b, struct cache_page, kpage_elem)->kpage;
+}
+
+void pagecache_init(void)
+{
+  hash_init(&page_table, page_hash_func, page_less_func, NULL);
+  hash_init(&kpage_table, kpage_hash_func, kpage_less_func, NULL);
+  list_init(&lru);
+  page_cnt = 0;
+  lock_init(&cache_lock);
+  cond_init(&page_loaded);
+}
+
+/* Reads SIZE bytes of INODE at OFFSET into BUFFER through the
+ * cache.  Returns the number of bytes read, which is short at end
+ * of file.  Falls back to reading the inode directly if no frame
+ * can be had for the cache. */
+off_t pagecache_read(struct inode *inode, void *buffer_, off_t size,
+    off_t offset)
+{
+  uint8_t *buffer = buffer_;
+  off_t length = inode_length(inode);
+  off_t done = 0;
+
+  if (offset < 0 || offset >= length || size <= 0)
+    return 0;
+  if (size > length - offset)
+    size = length - offset;
+
+  while (done < size)
+  {
+    off_t pos = offset + done;
+    off_t page_ofs = pos % PGSIZE;
+    off_t chunk = PGSIZE - page_ofs;
+    struct cache_page *p;
+
+    if (chunk > size - done)
+      chunk = size - done;
+
+    lock_acquire(&cache_lock);
+    p = get_page(inode, pos - page_ofs);
+    if (p != NULL)
+      p->pin_cnt++;
+    lock_release(&cache_lock);
+    if (p == NULL)
+      return done + inode_read_uncached(inode, buffer + done, size - done,
+          pos);
+
+    memcpy(buffer + done, (uint8_t *)p->kpage + page_ofs, chunk);
+
+    lock_acquire(&cache_lock);
+    p->pin_cnt--;
+    lock_release(&cache_lock);
+    done += chunk;
+  }
+
+  return done;
+}
+
+/* Brings the cached pages of INODE up to date with the SIZE bytes
+ * of BUFFER just written to it at OFFSET.  Pages not cached are
+ * left alone. */
+void pagecache_write(struct inode *inode, const void *buffer_, off_t size,
+    off_t offset)
+{
+  const uint8_t *buffer = buffer_;
+  off_t done = 0;
+
+  while (done < size)
+  {
+    off_t pos = offset + done;
+    off_t page_ofs = pos % PGSIZE;
+    off_t chunk = PGSIZE - page_ofs;
+    struct cache_page *p;
+
+    if (chunk > size - done)
+      chunk = size - done;
+
+    /* A page being read in may miss this write, so update it
+     * only once it is in */
+    lock_acquire(&cache_lock);
+    while ((p = lookup(inode, pos - page_ofs)) != NULL && p->loading)
+      cond_wait(&page_loaded, &cache_lock);
+    if (p != NULL)
+      p->pin_cnt++;
+    lock_release(&cache_lock);
+
+    if (p != NULL)
+    {
+      memcpy((uint8_t *)p->kpage + page_ofs, buffer + done, chunk);
+      lock_acquire(&cache_lock);
+      p->pin_cnt--;
+      lock_release(&cache_lock);
+    }
+    done += chunk;
+  }
+}
+
+/* Returns the cached frame for the page of INODE at OFFSET, to be
+ * mapped into a process, or NULL if no frame can be had.  The
+ * frame stays cached until pagecache_unmap(). */
+void *pagecache_map(struct inode *inode, off_t offset)
+{
+  struct cache_page *p;
+
+  ASSERT(offset % PGSIZE == 0);
+
+  lock_acquire(&cache_lock);
+  p = get_page(inode, offset);
+  if (p != NULL)
+  {
+    p->map_cnt++;
+    map_cnt++;
+  }
+  lock_release(&cache_lock);
+
+  return p != NULL ? p->kpage : NULL;
+}
+
+/* Drops one mapping of cached frame KPAGE, which was written to
+ * through it if DIRTY.  Returns true if that was the last mapping
+ * of a page orphaned by pagecache_drop(), whose frame is then
+ * freed.  Called by the frame layer, with the frame table lock
+ * held. */
+bool pagecache_unmap(void *kpage, bool dirty)
+{
+  struct cache_page key;
+  struct cache_page *p;
+  struct hash_elem *e;
+  bool freed = false;
+
+  ASSERT(lock_held_by_current_thread(&frame_table_lock));
+
+  key.kpage = kpage;
+  lock_acquire(&cache_lock);
+  e = hash_find(&kpage_table, &key.kpage_elem);
+  ASSERT(e != NULL);
+
+  p = hash_entry(e, struct cache_page, kpage_elem);
+  ASSERT(p->map_cnt > 0);
+  p->map_cnt--;
+  if (dirty)
+    p->dirty = true;
+  if (p->inode == NULL && p->map_cnt == 0 && p->pin_cnt == 0)
+  {
+    palloc_free_page(release_page(p));
+    freed = true;
+  }
+  lock_release(&cache_lock);
+
+  return freed;
+}
+
+/* Gives the least recently used clean, unmapped page back to the
+ * user pool.  Returns false if there is none.  Called by the frame
+ * allocator, which holds the frame table lock, so this must not
+ * write back. */
+bool pagecache_reclaim(void)
+{
+  struct list_elem *e;
+  bool success = false;
+
+  ASSERT(lock_held_by_current_thread(&frame_table_lock));
+
+  lock_acquire(&cache_lock);
+  for (e = list_rbegin(&lru); e != list_rend(&lru); e = list_prev(e))
+  {
+    struct cache_page *p = list_entry(e, struct cache_page, lru_elem);
+
+    if (p->map_cnt == 0 && p->pin_cnt == 0 && !p->dirty)
+    {
+      palloc_free_page(release_page(p));
+      success = true;
+      break;
+    }
+  }
+  lock_release(&cache_lock);
+
+  return success;
+}
+
+/* Forgets the cached pages of INODE, which is going away, first
+ * writing back those that may have changed if WRITE_BACK.  Pages
+ * still mapped are orphaned and freed when unmapped. */
+void pagecache_drop(struct inode *inode, bool write_back_)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire(&cache_lock);
+  for (e = list_begin(&lru); e != list_end(&lru); e = next)
+  {
+    struct cache_page *p = list_entry(e, struct cache_page, lru_elem);
+
+    next = list_next(e);
+    if (p->inode != inode)
+      continue;
+
+    if (write_back_ && (p->dirty || p->map_cnt > 0))
+    {
+      /* P is pinned meanwhile, so it stays, but the rest of the
+       * list may change while the lock is dropped */
+      write_back(p);
+      next = list_begin(&lru);
+    }
+
+    if (p->map_cnt > 0 || p->pin_cnt > 0)
+    {
+      hash_delete(&page_table, &p->hash_elem);
+      list_remove(&p->lru_elem);
+      p->inode = NULL;
+    }
+    else
+    {
+      /* The frame goes back through the frame layer, whose lock
+       * comes first */
+      void *kpage = release_page(p);
+
+      lock_release(&cache_lock);
+      frame_free_cache_page(kpage);
+      lock_acquire(&cache_lock);
+      next = list_begin(&lru);
+    }
+  }
+  lock_release(&cache_lock);
+}
+
+/* Writes back every page that may have changed */
+void pagecache_flush(void)
+{
+  struct list_elem *e;
+  unsigned pass;
+
+  lock_acquire(&cache_lock);
+  pass = ++flush_pass;
+  for (e = list_begin(&lru); e != list_end(&lru); )
+  {
+    struct cache_page *p = list_entry(e, struct cache_page, lru_elem);
+
+    if ((p->dirty || p->map_cnt > 0) && p->flush_pass != pass)
+    {
+      /* Start over, the list may have changed meanwhile */
+      p->flush_pass = pass;
+      write_back(p);
+      e = list_begin(&lru);
+    }
+    else
+      e = list_next(e);
+  }
+  lock_release(&cache_lock);
+}
+
+/* Prints page cache statistics */
+void pagecache_print_stats(void)
+{
+  printf("Page cache: %lld hits, %lld misses, %lld mapped, "
+      "%lld written back, %zu pages\n",
+      hit_cnt, miss_cnt, map_cnt, writeback_cnt, page_cnt);
+}
+
+/* Returns the cached page of INODE at OFFSET, reading it in if
+ * needed, or NULL if no frame is to be had.  Reading in reuses the
+ * least recently used idle page once the cache is full, writing it
+ * back first if it is dirty.  The cache lock must be held, and is
+ * dropped while writing back, reading in, or waiting for another
+ * thread to read the page in. */
+static struct cache_page *get_page(struct inode *inode, off_t offset)
+{
+  struct cache_page *p;
+  void *kpage = NULL;
+  off_t n;
+
+  ASSERT(lock_held_by_current_thread(&cache_lock));
+
+  for (;;)
+  {
+    struct list_elem *e;
+    struct cache_page *victim = NULL;
+
+    p = lookup(inode, offset);
+    if (p != NULL && p->loading)
+    {
+      /* Look again afterwards, it is ours to use once it is in */
+      cond_wait(&page_loaded, &cache_lock);
+      continue;
+    }
+    if (p != NULL)
+    {
+      hit_cnt++;
+      list_remove(&p->lru_elem);
+      list_push_front(&lru, &p->lru_elem);
+      return p;
+    }
+
+    if (page_cnt < PAGECACHE_MAX)
+    {
+      /* Hold a place while the lock is dropped */
+      page_cnt++;
+      lock_release(&cache_lock);
+      kpage = frame_get_cache_page();
+      lock_acquire(&cache_lock);
+      if (kpage != NULL && lookup(inode, offset) == NULL)
+        break;
+      page_cnt--;
+      if (kpage != NULL)
+      {
+        /* Someone else read the page in meanwhile */
+        lock_release(&cache_lock);
+        frame_free_cache_page(kpage);
+        lock_acquire(&cache_lock);
+        continue;
+      }
+    }
+
+    for (e = list_rbegin(&lru); e != list_rend(&lru); e = list_prev(e))
+    {
+      struct cache_page *q = list_entry(e, struct cache_page, lru_elem);
+      if (q->map_cnt == 0 && q->pin_cnt == 0)
+      {
+        victim = q;
+        break;
+      }
+    }
+    if (victim == NULL)
+      return NULL;
+    if (victim->dirty)
+    {
+      /* Look again afterwards, things may have changed */
+      write_back(victim);
+      continue;
+    }
+
+    /* Its place and frame go to the new page */
+    kpage = victim->kpage;
+    hash_delete(&page_table, &victim->hash_elem);
+    hash_delete(&kpage_table, &victim->kpage_elem);
+    list_remove(&victim->lru_elem);
+    free(victim);
+    break;
+  }
+
+  p = malloc(sizeof *p);
+  if (p == NULL)
+  {
+    page_cnt--;
+    lock_release(&cache_lock);
+    frame_free_cache_page(kpage);
+    lock_acquire(&cache_lock);
+    return NULL;
+  }
+  p->inode = inode;
+  p->offset = offset;
+  p->kpage = kpage;
+  p->map_cnt = 0;
+  p->pin_cnt = 1;
+  p->loading = true;
+  p->dirty = false;
+  p->flush_pass = 0;
+  hash_insert(&page_table, &p->hash_elem);
+  hash_insert(&kpage_table, &p->kpage_elem);
+  list_push_front(&lru, &p->lru_elem);
+  miss_cnt++;
+
+  /* Read in without the lock.  The page is pinned, so it stays,
+   * and a racing write waits for it, so it is not overwritten
+   * with older data from the disk. */
+  lock_release(&cache_lock);
+  n = inode_read_uncached(inode, kpage, PGSIZE, offset);
+  memset((uint8_t *)kpage + n, 0, PGSIZE - n);
+  lock_acquire(&cache_lock);
+  p->loading = false;
+  p->pin_cnt--;
+  cond_broadcast(&page_loaded, &cache_lock);
+  return p;
+}
+
+/* Returns the cached page of INODE at OFFSET, or NULL.  The cache
+ * lock must be held. */
+static struct cache_page *lookup(struct inode *inode, off_t offset)
+{
+  struct cache_page key;
+  struct hash_elem *e;
+
+  key.inode = inode;
+  key.offset = offset;
+  e = hash_find(&page_table, &key.hash_elem);
+  return e != NULL ? hash_entry(e, struct cache_page, hash_elem) : NULL;
+}
+
+/* Writes P back to its file and marks it clean.  The cache lock
+ * must be held, and is dropped meanwhile with P pinned. */
+static void write_back(struct cache_page *p)
+{
+  off_t length, size;
+
+  ASSERT(lock_held_by_current_thread(&cache_lock));
+
+  p->pin_cnt++;
+  p->dirty = false;
+  lock_release(&cache_lock);
+
+  length = inode_length(p->inode);
+  size = length - p->offset < PGSIZE ? length - p->offset : PGSIZE;
+  if (size > 0)
+    inode_write_uncached(p->inode, p->kpage, size, p->offset);
+
+  lock_acquire(&cache_lock);
+  p->pin_cnt--;
+  writeback_cnt++;
+}
+
+/* Frees P and returns its frame, which the caller frees.  The
+ * cache lock must be held. */
+static void *release_page(struct cache_page *p)
+{
+  void *kpage = p->kpage;
+
+  ASSERT(p->map_cnt == 0 && p->pin_cnt == 0);
+
+  if (p->inode != NULL)
+  {
+    hash_delete(&page_table, &p->hash_elem);
+    list_remove(&p->lru_elem);
+  }
+  hash_delete(&kpage_table, &p->kpage_elem);
+  free(p);
+  page_cnt--;
+  return kpage;
+}
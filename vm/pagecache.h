@@ -0,0 +1,19 @@
+#ifndef VM_PAGECACHE_H
+#define VM_PAGECACHE_H
+
+#include <stdbool.h>
+#include "filesys/inode.h"
+#include "filesys/off_t.h"
+
+void pagecache_init(void);
+off_t pagecache_read(struct inode *inode, void *buffer, off_t size,
+    off_t offset);
+void pagecache_write(struct inode *inode, const void *buffer, off_t size,
+    off_t offset);
+void *pagecache_map(struct inode *inode, off_t offset);
+bool pagecache_unmap(void *kpage, bool dirty);
+bool pagecache_reclaim(void);
+void pagecache_drop(struct inode *inode, bool write_back);
+void pagecache_flush(void);
+void pagecache_print_stats(void);
+#endif
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <klog.h>
 #include "swap.h"
 
 struct block *swap_device;
@@ -30,7 +31,7 @@ swap_init ()
   /* initialize all bits to be true */ 
   bitmap_set_all (swap_table, false);
   lock_init(&swap_lock);
-  printf("swap size in page %d...\n", swap_size_in_page());
+  klog(KLOG_INFO, "swap size in page %d...", (int) swap_size_in_page());
 }
 
 //static size_t swap_size_in_page(void)
@@ -43,20 +44,16 @@ size_t swap_in(struct frame *f)
 
 
   lock_acquire(&swap_lock);
-  printf("write to swap...\n");
+  klog(KLOG_DEBUG, "write to swap...");
   size_t index = bitmap_scan_and_flip(swap_table, 0, 1, false);
   if (index == BITMAP_ERROR)
     return SWAP_ERROR;
 
-  size_t counter = 0;
-  while (counter < SECTORS_PER_PAGE)
-  {
-    block_write(swap_device, index * SECTORS_PER_PAGE + counter,
-        f->kvir + counter * BLOCK_SECTOR_SIZE);
-    counter++;
-  }
+  /* The whole page goes in one request */
+  block_write_multiple(swap_device, index * SECTORS_PER_PAGE,
+      SECTORS_PER_PAGE, f->kvir);
   lock_release(&swap_lock);
-  printf("write complete...\n");
+  klog(KLOG_DEBUG, "write complete...");
 
   return index;
 }
@@ -66,17 +63,12 @@ bool swap_out(size_t idx, void *f)
   ASSERT(f != NULL);
 
   lock_acquire(&swap_lock);
-  printf("swap out...\n");
+  klog(KLOG_DEBUG, "swap out...");
   bitmap_set(swap_table, idx, false);
 
-  size_t counter = 0;
-  while (counter < SECTORS_PER_PAGE)
-  {
-    block_read(swap_device, idx * SECTORS_PER_PAGE + counter, 
-        f + counter * BLOCK_SECTOR_SIZE);
-    counter++;
-  }
-  printf("swap out complete...\n");
+  block_read_multiple(swap_device, idx * SECTORS_PER_PAGE,
+      SECTORS_PER_PAGE, f);
+  klog(KLOG_DEBUG, "swap out complete...");
   lock_release(&swap_lock);
 
   return true;